@@ -13,13 +13,15 @@
 uint64_t
 get_time_usec()
 {
-	static struct timeval _time_stamp;
-	gettimeofday(&_time_stamp, NULL);
-	return _time_stamp.tv_sec*1000000 + _time_stamp.tv_usec;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
 Autopilot_Interface::
-Autopilot_Interface(Generic_Port *port_)
+Autopilot_Interface(Generic_Port *port_) :
+	vehicles(256),
+	message_queue(4096)
 {
 	// initialize attributes
 	write_count = 0;
@@ -36,8 +38,26 @@ Autopilot_Interface(Generic_Port *port_)
 	autopilot_id = 0; // autopilot component id
 	companion_id = 0; // companion computer component id
 
-	current_messages.sysid  = system_id;
-	current_messages.compid = autopilot_id;
+	timesync_interval_ms = 1000;
+	timesync_count       = 0;
+	for ( int i = 0; i < TIMESYNC_PENDING; i++ )
+		timesync_sent[i] = 0;
+
+	use_reactor = false; // block on epoll instead of polling at 100Hz
+
+	// wakes the reactor up on shutdown
+	exit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if ( exit_fd < 0 )
+	{
+		fprintf(stderr,"ERROR: could not create eventfd\n");
+		throw 1;
+	}
+
+	last_vehicle    = NULL;
+	untracked_count = 0;
+
+	all_sinks  = 0;
+	subscribed = false; // every message to every sink until then
 
 	port = port_; // port management object
 
@@ -45,7 +65,9 @@ Autopilot_Interface(Generic_Port *port_)
 
 Autopilot_Interface::
 ~Autopilot_Interface()
-{}
+{
+	close(exit_fd);
+}
 
 // ------------------------------------------------------------------------------
 //   Read Messages
@@ -54,7 +76,6 @@ void
 Autopilot_Interface::
 read_messages()
 {
-	bool success;               // receive success flag
 	bool received_all = false;  // receive only one message
 	Time_Stamps this_timestamps;
 
@@ -62,197 +83,13 @@ read_messages()
 	while ( !received_all and !time_to_exit )
 	{
 		// ----------------------------------------------------------------------
-		//   READ MESSAGE
+		//   READ MESSAGES
 		// ----------------------------------------------------------------------
-		mavlink_message_t message;
-		success = port->read_message(message);
 
-		// ----------------------------------------------------------------------
-		//   HANDLE MESSAGE
-		// ----------------------------------------------------------------------
-		if( success )
-		{
-
-			// Store message sysid and compid.
-			// Note this doesn't handle multiple message sources.
-			current_messages.sysid  = message.sysid;
-			current_messages.compid = message.compid;
-
-			// Handle Message ID
-			switch (message.msgid)
-			{
-
-				case MAVLINK_MSG_ID_HEARTBEAT:
-				{
-					//SerialUSB << ("MAVLINK_MSG_ID_HEARTBEAT\n");
-					mavlink_msg_heartbeat_decode(&message, &(current_messages.heartbeat));
-					current_messages.time_stamps.heartbeat = get_time_usec();
-					this_timestamps.heartbeat = current_messages.time_stamps.heartbeat;
-					break;
-				}
-
-				case MAVLINK_MSG_ID_SYS_STATUS:
-				{
-					//SerialUSB << ("MAVLINK_MSG_ID_SYS_STATUS\n");
-					mavlink_msg_sys_status_decode(&message, &(current_messages.sys_status));
-					current_messages.time_stamps.sys_status = get_time_usec();
-					this_timestamps.sys_status = current_messages.time_stamps.sys_status;
-					break;
-				}
-
-				case MAVLINK_MSG_ID_BATTERY_STATUS:
-				{
-					//printf("MAVLINK_MSG_ID_BATTERY_STATUS\n");
-					mavlink_msg_battery_status_decode(&message, &(current_messages.battery_status));
-					current_messages.time_stamps.battery_status = get_time_usec();
-					this_timestamps.battery_status = current_messages.time_stamps.battery_status;
-					break;
-				}
-
-				case MAVLINK_MSG_ID_RADIO_STATUS:
-				{
-					//printf("MAVLINK_MSG_ID_RADIO_STATUS\n");
-					mavlink_msg_radio_status_decode(&message, &(current_messages.radio_status));
-					current_messages.time_stamps.radio_status = get_time_usec();
-					this_timestamps.radio_status = current_messages.time_stamps.radio_status;
-					break;
-				}
-
-				case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
-				{
-					//printf("MAVLINK_MSG_ID_LOCAL_POSITION_NED\n");
-					mavlink_msg_local_position_ned_decode(&message, &(current_messages.local_position_ned));
-					current_messages.time_stamps.local_position_ned = get_time_usec();
-					this_timestamps.local_position_ned = current_messages.time_stamps.local_position_ned;
-					break;
-				}
-
-				case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
-				{
-					//printf("MAVLINK_MSG_ID_GLOBAL_POSITION_INT\n");
-					mavlink_msg_global_position_int_decode(&message, &(current_messages.global_position_int));
-					current_messages.time_stamps.global_position_int = get_time_usec();
-					this_timestamps.global_position_int = current_messages.time_stamps.global_position_int;
-					break;
-				}
-
-				case MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED:
-				{
-					//printf("MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED\n");
-					mavlink_msg_position_target_local_ned_decode(&message, &(current_messages.position_target_local_ned));
-					current_messages.time_stamps.position_target_local_ned = get_time_usec();
-					this_timestamps.position_target_local_ned = current_messages.time_stamps.position_target_local_ned;
-					break;
-				}
-
-				case MAVLINK_MSG_ID_POSITION_TARGET_GLOBAL_INT:
-				{
-					//printf("MAVLINK_MSG_ID_POSITION_TARGET_GLOBAL_INT\n");
-					mavlink_msg_position_target_global_int_decode(&message, &(current_messages.position_target_global_int));
-					current_messages.time_stamps.position_target_global_int = get_time_usec();
-					this_timestamps.position_target_global_int = current_messages.time_stamps.position_target_global_int;
-					break;
-				}
-
-				case MAVLINK_MSG_ID_HIGHRES_IMU:
-				{
-					//SerialUSB << ("MAVLINK_MSG_ID_HIGHRES_IMU\n");
-					mavlink_msg_highres_imu_decode(&message, &(current_messages.highres_imu));
-					current_messages.time_stamps.highres_imu = get_time_usec();
-					this_timestamps.highres_imu = current_messages.time_stamps.highres_imu;
-					break;
-				}
-
-				case MAVLINK_MSG_ID_ATTITUDE:
-				{
-					//printf("MAVLINK_MSG_ID_ATTITUDE\n");
-					mavlink_msg_attitude_decode(&message, &(current_messages.attitude));
-					current_messages.time_stamps.attitude = get_time_usec();
-					this_timestamps.attitude = current_messages.time_stamps.attitude;
-					break;
-				}
-
-                case MAVLINK_MSG_ID_ATTITUDE_QUATERNION:
-                {
-                    mavlink_msg_attitude_quaternion_decode(&message, &(current_messages.attitude_quaternion));
-                    current_messages.time_stamps.attitude_quaternion = get_time_usec();
-                    this_timestamps.attitude_quaternion = current_messages.time_stamps.attitude_quaternion;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_ESTIMATOR_STATUS:
-                {
-                    mavlink_msg_estimator_status_decode(&message, &(current_messages.estimator_status));
-                    current_messages.time_stamps.estimator_status = get_time_usec();
-                    this_timestamps.estimator_status = current_messages.time_stamps.estimator_status;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_ODOMETRY:
-                {
-                    mavlink_msg_odometry_decode(&message, &(current_messages.odometry));
-                    current_messages.time_stamps.odometry = get_time_usec();
-                    this_timestamps.odometry = current_messages.time_stamps.odometry;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_VIBRATION:
-                {
-                    mavlink_msg_vibration_decode(&message, &(current_messages.vibration));
-                    current_messages.time_stamps.vibration = get_time_usec();
-                    this_timestamps.vibration = current_messages.time_stamps.vibration;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_ALTITUDE:
-                {
-                    mavlink_msg_altitude_decode(&message, &(current_messages.altitude));
-                    current_messages.time_stamps.altitude = get_time_usec();
-                    this_timestamps.altitude = current_messages.time_stamps.altitude;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_GPS_RTK:
-                {
-                    mavlink_msg_gps_rtk_decode(&message, &(current_messages.gps_rtk));
-                    current_messages.time_stamps.gps_rtk = get_time_usec();
-                    this_timestamps.gps_rtk = current_messages.time_stamps.gps_rtk;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_GPS_GLOBAL_ORIGIN:
-                {
-                    mavlink_msg_gps_global_origin_decode(&message, &(current_messages.gps_global_origin));
-                    current_messages.time_stamps.gps_global_origin = get_time_usec();
-                    this_timestamps.gps_global_origin = current_messages.time_stamps.gps_global_origin;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_GPS_RAW_INT:
-                {
-                    mavlink_msg_gps_raw_int_decode(&message, &(current_messages.gps_raw));
-                    current_messages.time_stamps.gps_raw = get_time_usec();
-                    this_timestamps.gps_raw = current_messages.time_stamps.gps_raw;
-                    break;
-                }
-
-                case MAVLINK_MSG_ID_GPS_STATUS:
-                {
-                    mavlink_msg_gps_status_decode(&message, &(current_messages.gps_status));
-                    current_messages.time_stamps.gps_status = get_time_usec();
-                    this_timestamps.gps_status = current_messages.time_stamps.gps_status;
-                    break;
-                }
-
-				default:
-				{
-					// printf("Warning, did not handle message id %i\n",message.msgid);
-					break;
-				}
-
-
-			}
-        }
+		// decodes everything the port has ready in one pass
+		port->read_messages([&](const mavlink_message_t &message) {
+			handle_message(message, this_timestamps);
+		});
 
         received_all = 
         		//this_timestamps.heartbeat                  &&
@@ -280,6 +117,237 @@ read_messages()
 	return;
 }
 
+// ------------------------------------------------------------------------------
+//   Handle Message
+// ------------------------------------------------------------------------------
+void
+Autopilot_Interface::
+handle_message(const mavlink_message_t &message, Time_Stamps &this_timestamps)
+{
+	uint64_t time_usec = get_time_usec();
+
+	// only replies to our own requests go on to the sinks
+	if ( message.msgid == MAVLINK_MSG_ID_TIMESYNC && timesync_interval_ms > 0 &&
+	     !handle_timesync(message, time_usec) )
+	{
+		return;
+	}
+
+	int sinks = _sinks(message.msgid);
+
+	// hand the message over to the sinks
+	if ( sinks & MESSAGE_SINK_QUEUE )
+	{
+		Mavlink_Event event;
+		event.time_usec = time_usec;
+		event.message   = message;
+		message_queue.push(event);
+	}
+
+	const Message_Entry *entry = find_message_entry(message.msgid);
+	if ( entry )
+	{
+		this_timestamps.*entry->stamp = time_usec;
+	}
+
+	// consecutive messages mostly come from the same component
+	Vehicle_State *vehicle = last_vehicle;
+	if ( vehicle == NULL || vehicle->messages.sysid != message.sysid || vehicle->messages.compid != message.compid )
+	{
+		vehicle = vehicles.insert(message.sysid, message.compid, [&](Vehicle_State &state) {
+			state.messages.sysid  = message.sysid;
+			state.messages.compid = message.compid;
+			printf("[INFO] New component %i:%i on the link.\n", message.sysid, message.compid);
+		});
+
+		if ( vehicle == NULL )
+		{
+			if ( untracked_count++ == 0 )
+				fprintf(stderr,"WARNING: more than %zu components, not keeping the state of new ones\n", vehicles.max_size());
+			return;
+		}
+		last_vehicle = vehicle;
+	}
+
+	// only what somebody reads is decoded
+	if ( entry == NULL || !(sinks & MESSAGE_SINK_STATE) )
+	{
+		return;
+	}
+
+	vehicle->lock.write_begin();
+	entry->store(message, vehicle->messages, time_usec);
+	vehicle->lock.write_end();
+}
+
+// ------------------------------------------------------------------------------
+//   Time Sync
+// ------------------------------------------------------------------------------
+
+// a request stamped with our clock, the reply brings it back along with the
+// autopilot's time
+void
+Autopilot_Interface::
+send_timesync()
+{
+	mavlink_timesync_t timesync = {};
+	timesync.tc1 = 0;
+	timesync.ts1 = (int64_t)get_time_usec() * 1000;
+	timesync.target_system    = system_id;
+	timesync.target_component = autopilot_id;
+
+	// known before the reply can be
+	timesync_sent[timesync_count++ % TIMESYNC_PENDING].store(timesync.ts1, std::memory_order_relaxed);
+
+	mavlink_message_t message;
+	mavlink_msg_timesync_encode(system_id, companion_id, &message, &timesync);
+	write_message(message);
+}
+
+// true for a reply to one of our requests
+bool
+Autopilot_Interface::
+handle_timesync(const mavlink_message_t &message, uint64_t time_usec)
+{
+	mavlink_timesync_t timesync;
+	mavlink_msg_timesync_decode(&message, &timesync);
+
+	// meant for somebody else on the link, 0 is everybody
+	if ( (timesync.target_system    && timesync.target_system    != system_id) ||
+	     (timesync.target_component && timesync.target_component != companion_id) )
+	{
+		return false;
+	}
+
+	if ( timesync.tc1 == 0 )
+	{
+		// the autopilot times the link too, answered with our receive time;
+		// not before the write thread knows who we are, nor our own requests
+		// coming back
+		if ( !writing_status || (message.sysid == system_id && message.compid == companion_id) )
+		{
+			return false;
+		}
+
+		// only to whoever asked
+		mavlink_timesync_t reply = {};
+		reply.tc1 = (int64_t)time_usec * 1000;
+		reply.ts1 = timesync.ts1;
+		reply.target_system    = message.sysid;
+		reply.target_component = message.compid;
+
+		mavlink_message_t out;
+		mavlink_msg_timesync_encode(system_id, companion_id, &out, &reply);
+		write_message(out);
+		return false;
+	}
+
+	for ( int i = 0; i < TIMESYNC_PENDING; i++ )
+	{
+		if ( timesync_sent[i].load(std::memory_order_relaxed) == timesync.ts1 )
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Subscriptions
+// ------------------------------------------------------------------------------
+void
+Autopilot_Interface::
+subscribe(uint32_t msgid, int sinks)
+{
+	if ( msgid >= subscriptions.size() )
+	{
+		subscriptions.resize(msgid + 1, 0);
+	}
+	subscriptions[msgid] |= sinks;
+	subscribed = true;
+}
+
+void
+Autopilot_Interface::
+subscribe_all(int sinks)
+{
+	all_sinks |= sinks;
+	subscribed = true;
+}
+
+int
+Autopilot_Interface::
+_sinks(uint32_t msgid)
+{
+	if ( !subscribed )
+	{
+		return MESSAGE_SINK_QUEUE | MESSAGE_SINK_STATE;
+	}
+	return (msgid < subscriptions.size() ? subscriptions[msgid] : 0) | all_sinks;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Wait for Message
+// ------------------------------------------------------------------------------
+// Pops the next event published by the read thread, sleeping up to
+// timeout_ms while there is none. Meant for a single consumer thread.
+bool
+Autopilot_Interface::
+wait_message(Mavlink_Event &event, int timeout_ms)
+{
+	return message_queue.wait_pop(event, timeout_ms);
+}
+
+// Messages lost because the consumer fell behind and the queue was full
+uint64_t
+Autopilot_Interface::
+dropped_messages()
+{
+	return message_queue.dropped();
+}
+
+// ------------------------------------------------------------------------------
+//   Get Messages
+// ------------------------------------------------------------------------------
+// Copies the messages of a component as a whole, never a half written one.
+void
+Autopilot_Interface::
+get_messages(Mavlink_Messages &messages)
+{
+	Vehicle_State *vehicle = autopilot();
+	if ( vehicle == NULL )
+	{
+		messages = Mavlink_Messages();
+		return;
+	}
+	vehicle->lock.read(messages, vehicle->messages);
+}
+
+void
+Autopilot_Interface::
+get_messages(size_t index, Mavlink_Messages &messages)
+{
+	Vehicle_State *vehicle = vehicles.at(index);
+	vehicle->lock.read(messages, vehicle->messages);
+}
+
+// The component we talk to, the first one heard until the ids are known
+Vehicle_State *
+Autopilot_Interface::
+autopilot()
+{
+	if ( system_id )
+	{
+		Vehicle_State *vehicle = vehicles.find(system_id, autopilot_id);
+		if ( vehicle )
+			return vehicle;
+	}
+	return vehicles.size() ? vehicles.at(0) : NULL;
+}
+
 // ------------------------------------------------------------------------------
 //   Write Message
 // ------------------------------------------------------------------------------
@@ -337,7 +405,7 @@ start()
 
 	printf("CHECK FOR MESSAGES\n");
 
-	while ( not current_messages.sysid )
+	while ( not get_message(&Mavlink_Messages::sysid) )
 	{
 		if ( time_to_exit )
 			return;
@@ -362,14 +430,14 @@ start()
 	// System ID
 	if ( not system_id )
 	{
-		system_id = current_messages.sysid;
+		system_id = get_message(&Mavlink_Messages::sysid);
 		printf("GOT VEHICLE SYSTEM ID: %i\n", system_id );
 	}
 
 	// Component ID
 	if ( not autopilot_id )
 	{
-		autopilot_id = current_messages.compid;
+		autopilot_id = get_message(&Mavlink_Messages::compid);
 		printf("GOT AUTOPILOT COMPONENT ID: %i\n", autopilot_id);
 		printf("\n");
 	}
@@ -383,8 +451,8 @@ start()
 	result = pthread_create( &write_tid, NULL, &start_autopilot_interface_write_thread, this );
 	if ( result ) throw result;
 
-	// wait for it to be started
-	while ( not writing_status )
+	// wait for it to be started, a quit meanwhile may end it right away
+	while ( not writing_status and not time_to_exit )
 		usleep(100000); // 10Hz
 
 	// now we're streaming setpoint commands
@@ -412,9 +480,20 @@ stop()
 	// signal exit
 	time_to_exit = true;
 
-	// wait for exit
-	pthread_join(read_tid ,NULL);
-	pthread_join(write_tid,NULL);
+	// wake the reactor up
+	uint64_t one = 1;
+	if ( write(exit_fd, &one, sizeof(one)) < 0 )
+	{
+		fprintf(stderr,"WARNING: could not signal read thread exit\n");
+	}
+
+	// wait for exit, a quit during start() may leave a thread unstarted
+	if ( read_tid )
+		pthread_join(read_tid ,NULL);
+	if ( write_tid )
+		pthread_join(write_tid,NULL);
+	read_tid  = 0;
+	write_tid = 0;
 
 	// now the read and write threads are closed
 	printf("\n");
@@ -473,15 +552,14 @@ void
 Autopilot_Interface::
 handle_quit( int sig )
 {
+	time_to_exit = true;
 
-	try {
-		stop();
-
-	}
-	catch (int error) {
-		fprintf(stderr,"Warning, could not stop autopilot interface\n");
+	// wake the reactor up, write() is fine in a signal handler
+	uint64_t one = 1;
+	if ( write(exit_fd, &one, sizeof(one)) < 0 )
+	{
+		// stop() signals it again
 	}
-
 }
 
 
@@ -495,10 +573,17 @@ read_thread()
 {
 	reading_status = true;
 
-	while ( ! time_to_exit )
+	if ( use_reactor )
 	{
-		read_messages();
-		usleep(10000); // Read batches at 100Hz
+		read_thread_reactor();
+	}
+	else
+	{
+		while ( ! time_to_exit )
+		{
+			read_messages();
+			usleep(10000); // Read batches at 100Hz
+		}
 	}
 
 	reading_status = false;
@@ -507,6 +592,88 @@ read_thread()
 }
 
 
+// ------------------------------------------------------------------------------
+//   Read Thread - Reactor
+// ------------------------------------------------------------------------------
+// Blocks on epoll over the port and the exit eventfd, and drains everything
+// readable as soon as it arrives instead of sleeping between batches.
+void
+Autopilot_Interface::
+read_thread_reactor()
+{
+	Time_Stamps this_timestamps;
+
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if ( epoll_fd < 0 )
+	{
+		perror("error epoll_create1 failed");
+		return;
+	}
+
+	struct epoll_event event;
+
+	event.events  = EPOLLIN;
+	event.data.fd = port->get_fd();
+	if ( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, port->get_fd(), &event) < 0 )
+	{
+		perror("error epoll_ctl failed on port");
+		close(epoll_fd);
+		return;
+	}
+
+	event.events  = EPOLLIN;
+	event.data.fd = exit_fd;
+	if ( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, exit_fd, &event) < 0 )
+	{
+		perror("error epoll_ctl failed on eventfd");
+		close(epoll_fd);
+		return;
+	}
+
+	port->set_blocking(false);
+
+	bool port_closed = false;
+
+	while ( ! time_to_exit and ! port_closed )
+	{
+		struct epoll_event events[2];
+		int n = epoll_wait(epoll_fd, events, 2, -1);
+
+		if ( n < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+
+			perror("error epoll_wait failed");
+			break;
+		}
+
+		for ( int i = 0; i < n; i++ )
+		{
+			if ( events[i].data.fd == exit_fd )
+				continue;
+
+			if ( events[i].events & (EPOLLERR | EPOLLHUP) )
+			{
+				fprintf(stderr,"ERROR: port closed, stopping read thread\n");
+				port_closed = true;
+				break;
+			}
+
+			// drain until the port would block
+			while ( port->read_messages([&](const mavlink_message_t &message) {
+				handle_message(message, this_timestamps);
+			}) > 0 );
+		}
+	}
+
+	port->set_blocking(true);
+	close(epoll_fd);
+
+	return;
+}
+
+
 // ------------------------------------------------------------------------------
 //   Write Thread
 // ------------------------------------------------------------------------------
@@ -535,9 +702,21 @@ write_thread(void)
 
 	// Pixhawk needs to see off-board commands at minimum 2Hz,
 	// otherwise it will go into fail safe
+	uint64_t next_timesync = 0;
 	while ( !time_to_exit )
 	{
-		usleep(250000);   // Stream at 4Hz
+		uint64_t now = get_time_usec();
+		if ( timesync_interval_ms > 0 && now >= next_timesync )
+		{
+			send_timesync();
+			next_timesync = now + (uint64_t)timesync_interval_ms * 1000;
+		}
+
+		// Stream at 4Hz, faster for shorter time sync intervals
+		if ( timesync_interval_ms > 0 && timesync_interval_ms < 250 )
+			usleep(timesync_interval_ms * 1000);
+		else
+			usleep(250000);
 	}
 
 	// signal end
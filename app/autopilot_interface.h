@@ -12,13 +12,22 @@
 // ------------------------------------------------------------------------------
 
 #include "generic_port.h"
+#include "seqlock.h"
+#include "message_queue.h"
+#include "vehicle_table.h"
+#include "message_registry.h"
 
 #include <signal.h>
+#include <errno.h>
 #include <time.h>
 #include <sys/time.h>
 #include <pthread.h> // This uses POSIX Threads
 #include <unistd.h>  // UNIX standard function definitions
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <mutex>
+#include <atomic>
+#include <vector>
 
 #include <common/mavlink.h>
 #include <development/mavlink.h>
@@ -74,12 +83,21 @@
 #define MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_LOITER       0x3000
 #define MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_IDLE         0x4000
 
+// What a sink wants of a message, see Autopilot_Interface::subscribe()
+#define MESSAGE_SINK_QUEUE 1 // every one, as an event from wait_message()
+#define MESSAGE_SINK_STATE 2 // the latest per component, from get_message()
+
+// TIMESYNC requests a reply can still be matched to
+#define TIMESYNC_PENDING 4
+
 // ------------------------------------------------------------------------------
 //   Prototypes
 // ------------------------------------------------------------------------------
 
 
 // helper functions
+
+// monotonic, for receive times and intervals; never steps with the wall clock
 uint64_t get_time_usec();
 void set_position(float x, float y, float z, mavlink_set_position_target_local_ned_t &sp);
 void set_velocity(float vx, float vy, float vz, mavlink_set_position_target_local_ned_t &sp);
@@ -102,48 +120,17 @@ struct Time_Stamps
 		reset_timestamps();
 	}
 
-	uint64_t heartbeat;
-	uint64_t sys_status;
-	uint64_t battery_status;
-	uint64_t radio_status;
-	uint64_t local_position_ned;
-	uint64_t global_position_int;
-	uint64_t position_target_local_ned;
-	uint64_t position_target_global_int;
-	uint64_t highres_imu;
-	uint64_t attitude;
-    uint64_t attitude_quaternion;
-    uint64_t estimator_status;
-    uint64_t odometry;
-    uint64_t vibration;
-    uint64_t altitude;
-    uint64_t gps_rtk;
-    uint64_t gps_global_origin;
-    uint64_t gps_raw;
-    uint64_t gps_status;
+	// receive time of the latest of each kept message, 0 if none yet
+#define MESSAGE_STAMP(NAME, name, member) uint64_t member;
+	MAVLINK_KEPT_MESSAGES(MESSAGE_STAMP)
+#undef MESSAGE_STAMP
 
 	void
 	reset_timestamps()
 	{
-		heartbeat = 0;
-		sys_status = 0;
-		battery_status = 0;
-		radio_status = 0;
-		local_position_ned = 0;
-		global_position_int = 0;
-		position_target_local_ned = 0;
-		position_target_global_int = 0;
-		highres_imu = 0;
-		attitude = 0;
-        attitude_quaternion = 0;
-        estimator_status = 0;
-        odometry = 0;
-        vibration = 0;
-        altitude = 0;
-        gps_rtk = 0;
-        gps_global_origin = 0;
-        gps_raw = 0;
-        gps_status = 0;
+#define MESSAGE_RESET(NAME, name, member) member = 0;
+		MAVLINK_KEPT_MESSAGES(MESSAGE_RESET)
+#undef MESSAGE_RESET
 	}
 
 };
@@ -153,74 +140,40 @@ struct Mavlink_Messages {
 	int sysid;
 	int compid;
 
-	// Heartbeat
-	mavlink_heartbeat_t heartbeat;
-
-	// System Status
-	mavlink_sys_status_t sys_status;
-
-	// Battery Status
-	mavlink_battery_status_t battery_status;
-
-	// Radio Status
-	mavlink_radio_status_t radio_status;
-
-	// Local Position
-	mavlink_local_position_ned_t local_position_ned;
-
-	// Global Position
-	mavlink_global_position_int_t global_position_int;
-
-	// Local Position Target
-	mavlink_position_target_local_ned_t position_target_local_ned;
-
-	// Global Position Target
-	mavlink_position_target_global_int_t position_target_global_int;
-
-	// HiRes IMU
-	mavlink_highres_imu_t highres_imu;
-
-	// Attitude
-	mavlink_attitude_t attitude;
-
-    // Attitude Quaternion
+	// latest of each kept message, see message_registry.h
+#define MESSAGE_SLOT(NAME, name, member) mavlink_##name##_t member;
+	MAVLINK_KEPT_MESSAGES(MESSAGE_SLOT)
+#undef MESSAGE_SLOT
 
-    mavlink_attitude_quaternion_t attitude_quaternion;
-
-    // Estimator Status
-
-    mavlink_estimator_status_t estimator_status;
+	// Time Stamps
+	Time_Stamps time_stamps;
 
-    // Odometry
+	void
+	reset_timestamps()
+	{
+		time_stamps.reset_timestamps();
+	}
 
-    mavlink_odometry_t odometry;
+};
 
-    // Vibration
 
-    mavlink_vibration_t vibration;
+// Latest messages of one component, guarded against the read thread
+struct Vehicle_State {
 
-	// Altitude
+	Seqlock lock;
 
-    mavlink_altitude_t altitude;
+	Mavlink_Messages messages;
 
-    // GPS
+};
 
-    mavlink_gps_rtk_t gps_rtk;
 
-    mavlink_gps_global_origin_t gps_global_origin;
+// Every decoded message, as handed from the read thread to the sinks
+struct Mavlink_Event {
 
-    mavlink_gps_raw_int_t gps_raw;
+	// Receive time, from get_time_usec()
+	uint64_t time_usec;
 
-    mavlink_gps_status_t gps_status;
-
-	// Time Stamps
-	Time_Stamps time_stamps;
-
-	void
-	reset_timestamps()
-	{
-		time_stamps.reset_timestamps();
-	}
+	mavlink_message_t message;
 
 };
 
@@ -232,8 +185,9 @@ struct Mavlink_Messages {
  * Autopilot Interface Class
  *
  * This starts two threads for read and write over MAVlink. The read thread
- * listens for any MAVlink message and pushes it to the current_messages
- * attribute.  The write thread at the moment only streams a position target
+ * listens for any MAVlink message and keeps the latest of each kind per
+ * (sysid, compid), so vehicles sharing a link don't mix.  The write thread runs the
+ * TIMESYNC protocol with the autopilot, the replies time the link.  It also holds a position target
  * in the local NED frame (mavlink_set_position_target_local_ned_t), which
  * is changed by using the method update_setpoint().  Sending these messages
  * are only half the requirement to get response from the autopilot, a signal
@@ -254,13 +208,56 @@ public:
 	char reading_status;
 	char writing_status;
 	char control_status;
-    uint64_t write_count;
+    std::atomic<uint64_t> write_count;
 
     int system_id;
 	int autopilot_id;
 	int companion_id;
 
-	Mavlink_Messages current_messages;
+	bool use_reactor;
+
+	// the write thread sends a TIMESYNC request every timesync_interval_ms,
+	// 0 for none; replies to them go to the sinks, requests of the autopilot
+	// are answered
+	int timesync_interval_ms;
+
+	// before start(): the messages sinks want, anything else is skipped
+	// before decoding or queueing. Until the first call every message is
+	// queued and every kept one decoded.
+	void subscribe(uint32_t msgid, int sinks);
+	void subscribe_all(int sinks);
+
+	// consistent copies of the latest messages, safe while the read thread
+	// runs; without sysid and compid they come from the autopilot
+	void get_messages(Mavlink_Messages &messages);
+
+	template <typename T>
+	T get_message(T Mavlink_Messages::*member)
+	{
+		T message = T();
+		Vehicle_State *vehicle = autopilot();
+		if ( vehicle )
+			vehicle->lock.read(message, vehicle->messages.*member);
+		return message;
+	}
+
+	template <typename T>
+	bool get_message(int sysid, int compid, T Mavlink_Messages::*member, T &message)
+	{
+		Vehicle_State *vehicle = vehicles.find(sysid, compid);
+		if ( vehicle == NULL )
+			return false;
+		vehicle->lock.read(message, vehicle->messages.*member);
+		return true;
+	}
+
+	// every component heard so far, in order of first message
+	size_t vehicle_count() { return vehicles.size(); }
+	void get_messages(size_t index, Mavlink_Messages &messages);
+
+	// next message from the read thread, false if none within timeout_ms
+	bool wait_message(Mavlink_Event &event, int timeout_ms);
+	uint64_t dropped_messages();
 
 	void read_messages();
 	int  write_message(mavlink_message_t message);
@@ -271,6 +268,7 @@ public:
 	void start_read_thread();
 	void start_write_thread(void);
 
+	// asks the threads to exit, safe in a signal handler; stop() joins them
 	void handle_quit( int sig );
 
 
@@ -278,7 +276,24 @@ private:
 
 	Generic_Port *port;
 
-	bool time_to_exit;
+	std::atomic<bool> time_to_exit;
+	int  exit_fd;
+
+	// latest messages per (sysid, compid), written by the read thread only
+	Vehicle_Table<Vehicle_State> vehicles;
+	Vehicle_State *last_vehicle;
+	uint64_t untracked_count;
+
+	Vehicle_State *autopilot();
+
+	// MESSAGE_SINK_* flags by msgid
+	std::vector<uint8_t> subscriptions;
+	int  all_sinks;
+	bool subscribed;
+	int _sinks(uint32_t msgid);
+
+	// every message in arrival order, read thread to a single sink thread
+	Message_Queue<Mavlink_Event> message_queue;
 
 	pthread_t read_tid;
 	pthread_t write_tid;
@@ -288,9 +303,19 @@ private:
 		mavlink_set_position_target_local_ned_t data;
 	} current_setpoint;
 
+	// ts1 of the latest requests, replies to other nodes don't match
+	std::atomic<int64_t> timesync_sent[TIMESYNC_PENDING];
+	unsigned timesync_count;
+
 	void read_thread();
+	void read_thread_reactor();
 	void write_thread(void);
 
+	void handle_message(const mavlink_message_t &message, Time_Stamps &this_timestamps);
+
+	void send_timesync();
+	bool handle_timesync(const mavlink_message_t &message, uint64_t time_usec);
+
 };
 
 
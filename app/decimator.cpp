@@ -0,0 +1,389 @@
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "decimator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Decimator Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Decimator::
+Decimator()
+{
+	in_count  = 0;
+	out_count = 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Rules
+// ------------------------------------------------------------------------------
+bool
+Decimator::
+add_rule(const char *spec)
+{
+	Decimation_Rule rule;
+	rule.mode        = DECIMATE_ALL;
+	rule.interval_ns = 0;
+	rule.deadband    = 0;
+
+	const char *equal = strchr(spec, '=');
+	if ( equal == NULL || equal == spec )
+	{
+		printf("[ERROR] Bad decimation rule %s, expected message[.field]=mode[:argument...]\n", spec);
+		return false;
+	}
+
+	std::string target(spec, equal - spec);
+	size_t dot = target.find('.');
+	rule.message = target.substr(0, dot);
+	if ( dot != std::string::npos )
+	{
+		rule.field = target.substr(dot + 1);
+	}
+
+	// mode and up to two numbers
+	char mode[16];
+	double first = 0, second = 0;
+	int parsed = sscanf(equal + 1, "%15[a-z]:%lf:%lf", mode, &first, &second);
+
+	double hz = 0;
+	bool ok   = parsed >= 1;
+
+	if ( ok && strcmp(mode, "all") == 0 )
+	{
+		rule.mode = DECIMATE_ALL;
+		ok = parsed == 1;
+	}
+	else if ( ok && strcmp(mode, "last") == 0 )
+	{
+		rule.mode = DECIMATE_LAST;
+		hz = first;
+		ok = parsed == 2 && hz > 0;
+	}
+	else if ( ok && strcmp(mode, "mean") == 0 )
+	{
+		rule.mode = DECIMATE_MEAN;
+		hz = first;
+		ok = parsed == 2 && hz > 0;
+	}
+	else if ( ok && strcmp(mode, "minmax") == 0 )
+	{
+		rule.mode = DECIMATE_MINMAX;
+		hz = first;
+		ok = parsed == 2 && hz > 0;
+	}
+	else if ( ok && strcmp(mode, "deadband") == 0 )
+	{
+		rule.mode     = DECIMATE_DEADBAND;
+		rule.deadband = first;
+		hz = parsed == 3 ? second : 0;
+		ok = parsed >= 2 && first >= 0 && hz >= 0;
+	}
+	else
+	{
+		ok = false;
+	}
+
+	if ( !ok )
+	{
+		printf("[ERROR] Bad decimation rule %s, modes are all, last:<hz>, mean:<hz>, minmax:<hz>, deadband:<delta>[:<hz>]\n", spec);
+		return false;
+	}
+
+	if ( hz > 0 )
+	{
+		rule.interval_ns = (uint64_t)(1e9 / hz);
+	}
+
+	rules.push_back(rule);
+
+	// filters already resolved would miss the new rule
+	messages.clear();
+
+	return true;
+}
+
+void
+Decimator::
+copy_rules(const Decimator &other)
+{
+	rules = other.rules;
+	messages.clear();
+}
+
+// most specific rule for a field, later rules win between equals
+const Decimation_Rule *
+Decimator::
+_match(const Line_Key &measurement, const Line_Key &name)
+{
+	const Decimation_Rule *best = NULL;
+	int best_score = 0;
+
+	for ( const Decimation_Rule &rule : rules )
+	{
+		int score;
+		if ( rule.message == "*" )
+		{
+			score = 1;
+		}
+		else if ( rule.message.size() == measurement.size() &&
+		          memcmp(rule.message.data(), measurement.data(), measurement.size()) == 0 )
+		{
+			score = 2;
+		}
+		else
+		{
+			continue;
+		}
+
+		if ( !rule.field.empty() )
+		{
+			if ( rule.field.size() != name.size() || memcmp(rule.field.data(), name.data(), name.size()) != 0 )
+			{
+				continue;
+			}
+			score += 2;
+		}
+
+		if ( score >= best_score )
+		{
+			best = &rule;
+			best_score = score;
+		}
+	}
+
+	// an explicit all is the same as no rule
+	if ( best && best->mode == DECIMATE_ALL )
+	{
+		return NULL;
+	}
+	return best;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Messages
+// ------------------------------------------------------------------------------
+void
+Decimator::
+begin(Decimation_Cursor &cursor, const Line_Key &measurement, int sysid, int compid, uint64_t now)
+{
+	cursor.measurement = &measurement;
+	cursor.index       = 0;
+	cursor.now         = now;
+
+	if ( rules.empty() )
+	{
+		cursor.fields = NULL;
+		return;
+	}
+
+	Message_Key key;
+	key.sysid       = sysid;
+	key.compid      = compid;
+	key.measurement = &measurement;
+
+	cursor.fields = &messages[key];
+}
+
+// filter of the next field, NULL if it is written as is
+Field_Filter *
+Decimator::
+_next(Decimation_Cursor &cursor, const Line_Key &name, const Line_Key &key)
+{
+	in_count++;
+
+	if ( cursor.fields == NULL )
+	{
+		out_count++;
+		return NULL;
+	}
+
+	std::vector<Field_Filter> &fields = *cursor.fields;
+
+	// first time through this message
+	if ( cursor.index == fields.size() )
+	{
+		Field_Filter filter;
+		memset(&filter, 0, sizeof(filter));
+		filter.rule = _match(*cursor.measurement, name);
+
+		if ( filter.rule && filter.rule->mode == DECIMATE_MINMAX )
+		{
+			keys.emplace_back(key, "_min");
+			filter.min_key = &keys.back();
+			keys.emplace_back(key, "_max");
+			filter.max_key = &keys.back();
+		}
+
+		fields.push_back(filter);
+	}
+
+	Field_Filter *filter = &fields[cursor.index++];
+	if ( filter->rule == NULL )
+	{
+		out_count++;
+		return NULL;
+	}
+	return filter;
+}
+
+// returns how many values to write, 0, 1 (out) or 2 (min and max)
+int
+Decimator::
+_sample(Field_Filter &filter, double value, uint64_t now, double &out, double &min, double &max)
+{
+	const Decimation_Rule &rule = *filter.rule;
+
+	// NaN can't be written anyway and would poison the aggregates
+	if ( isnan(value) )
+	{
+		return 0;
+	}
+
+	if ( rule.mode == DECIMATE_DEADBAND )
+	{
+		if ( filter.written && fabs(value - filter.last) <= rule.deadband )
+		{
+			return 0;
+		}
+		if ( now < filter.next_write )
+		{
+			return 0;
+		}
+		filter.last       = value;
+		filter.written    = true;
+		filter.next_write = now + rule.interval_ns;
+		out = value;
+		out_count++;
+		return 1;
+	}
+
+	if ( filter.count == 0 )
+	{
+		filter.sum = 0;
+		filter.min = value;
+		filter.max = value;
+	}
+	filter.sum += value;
+	filter.min  = fmin(filter.min, value);
+	filter.max  = fmax(filter.max, value);
+	filter.count++;
+
+	if ( now < filter.next_write )
+	{
+		return 0;
+	}
+
+	int written = 1;
+	switch ( rule.mode )
+	{
+		case DECIMATE_LAST:
+			out = value;
+			break;
+
+		case DECIMATE_MEAN:
+			out = filter.sum / filter.count;
+			break;
+
+		case DECIMATE_MINMAX:
+			min = filter.min;
+			max = filter.max;
+			written = 2;
+			break;
+	}
+
+	filter.count      = 0;
+	filter.next_write = now + rule.interval_ns;
+	out_count += written;
+
+	return written;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Fields
+// ------------------------------------------------------------------------------
+void
+Decimator::
+field(Line_Buffer &point, Decimation_Cursor &cursor, const Line_Key &name, const Line_Key &key, float value)
+{
+	Field_Filter *filter = _next(cursor, name, key);
+	if ( filter == NULL )
+	{
+		point.field(key, value);
+		return;
+	}
+
+	double out, min, max;
+	switch ( _sample(*filter, value, cursor.now, out, min, max) )
+	{
+		case 1:
+			point.field(key, (float)out);
+			break;
+		case 2:
+			point.field(*filter->min_key, (float)min);
+			point.field(*filter->max_key, (float)max);
+			break;
+	}
+}
+
+void
+Decimator::
+field(Line_Buffer &point, Decimation_Cursor &cursor, const Line_Key &name, const Line_Key &key, double value)
+{
+	Field_Filter *filter = _next(cursor, name, key);
+	if ( filter == NULL )
+	{
+		point.field(key, value);
+		return;
+	}
+
+	double out, min, max;
+	switch ( _sample(*filter, value, cursor.now, out, min, max) )
+	{
+		case 1:
+			point.field(key, out);
+			break;
+		case 2:
+			point.field(*filter->min_key, min);
+			point.field(*filter->max_key, max);
+			break;
+	}
+}
+
+void
+Decimator::
+field_int(Line_Buffer &point, Decimation_Cursor &cursor, const Line_Key &name, const Line_Key &key, int64_t value)
+{
+	Field_Filter *filter = _next(cursor, name, key);
+	if ( filter == NULL )
+	{
+		point.field_int(key, value);
+		return;
+	}
+
+	// a field keeps its type, or InfluxDB rejects the points
+	double out, min, max;
+	switch ( _sample(*filter, (double)value, cursor.now, out, min, max) )
+	{
+		case 1:
+			point.field_int(key, llround(out));
+			break;
+		case 2:
+			point.field_int(*filter->min_key, llround(min));
+			point.field_int(*filter->max_key, llround(max));
+			break;
+	}
+}
@@ -0,0 +1,155 @@
+#ifndef DECIMATOR_H_
+#define DECIMATOR_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "line_protocol.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+#define DECIMATE_ALL      0  // every sample
+#define DECIMATE_LAST     1  // latest sample, at most rate per second
+#define DECIMATE_MEAN     2  // mean of the samples since the last write
+#define DECIMATE_MINMAX   3  // <field>_min and <field>_max since the last write
+#define DECIMATE_DEADBAND 4  // samples that moved more than the threshold
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+struct Decimation_Rule
+{
+	std::string message;  // measurement name, "*" for all
+	std::string field;    // empty for every field of the message
+	int mode;
+	uint64_t interval_ns; // 0 for no rate limit
+	double deadband;
+};
+
+// state of one field of one message from one component
+struct Field_Filter
+{
+	const Decimation_Rule *rule;  // NULL writes every sample
+	const Line_Key *min_key;
+	const Line_Key *max_key;
+
+	uint64_t next_write;
+	double last;
+	double sum;
+	double min;
+	double max;
+	uint32_t count;
+	bool written;
+};
+
+// fields of the message being written, in the order they are written
+struct Decimation_Cursor
+{
+	std::vector<Field_Filter> *fields;  // NULL when nothing is decimated
+	const Line_Key *measurement;
+	size_t index;
+	uint64_t now;
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Decimator Class
+// ----------------------------------------------------------------------------------
+/*
+ * Decimator Class
+ *
+ * Thins out the fields on their way to the line protocol. Rules are given per
+ * message or per field of a message, as
+ *
+ *     message[.field]=mode[:argument...]
+ *
+ *     all                    every sample, the default
+ *     last:<hz>              latest sample, at most hz times per second
+ *     mean:<hz>              mean of the samples in between
+ *     minmax:<hz>            <field>_min and <field>_max in between
+ *     deadband:<delta>[:<hz>] samples that moved more than delta
+ *
+ * The most specific rule wins, a field rule over a message rule over a "*"
+ * rule. Messages are named after their measurement, so the same rules work
+ * for both schemas.
+ *
+ * A window is written by the first sample past its end, so the value written
+ * is never late and nothing runs without samples. Integer fields stay
+ * integers, their mean is rounded.
+ *
+ * Filters are kept per (sysid, compid, message) and found once per message,
+ * fields then just step through them.
+ */
+class Decimator
+{
+
+public:
+
+	Decimator();
+
+	// false with a message printed if the rule can't be parsed
+	bool add_rule(const char *spec);
+	bool enabled() const { return !rules.empty(); }
+
+	// same rules as other, for another thread with its own filters
+	void copy_rules(const Decimator &other);
+
+	// starts a message, its fields then go through field()
+	void begin(Decimation_Cursor &cursor, const Line_Key &measurement, int sysid, int compid, uint64_t now);
+
+	// name is the field the rules refer to, key the one written
+	void field(Line_Buffer &point, Decimation_Cursor &cursor, const Line_Key &name, const Line_Key &key, float value);
+	void field(Line_Buffer &point, Decimation_Cursor &cursor, const Line_Key &name, const Line_Key &key, double value);
+	void field_int(Line_Buffer &point, Decimation_Cursor &cursor, const Line_Key &name, const Line_Key &key, int64_t value);
+
+	uint64_t samples_in()  const { return in_count; }
+	uint64_t samples_out() const { return out_count; }
+
+private:
+
+	struct Message_Key
+	{
+		int sysid;
+		int compid;
+		const Line_Key *measurement;
+
+		bool operator<(const Message_Key &other) const
+		{
+			if ( sysid != other.sysid )
+				return sysid < other.sysid;
+			if ( compid != other.compid )
+				return compid < other.compid;
+			return measurement < other.measurement;
+		}
+	};
+
+	std::deque<Decimation_Rule> rules;
+	std::map<Message_Key, std::vector<Field_Filter> > messages;
+
+	// _min and _max keys, kept for the filters pointing to them
+	std::deque<Line_Key> keys;
+
+	uint64_t in_count;
+	uint64_t out_count;
+
+	Field_Filter *_next(Decimation_Cursor &cursor, const Line_Key &name, const Line_Key &key);
+	const Decimation_Rule *_match(const Line_Key &measurement, const Line_Key &name);
+	int _sample(Field_Filter &filter, double value, uint64_t now, double &out, double &min, double &max);
+
+};
+
+
+
+#endif // DECIMATOR_H_
@@ -0,0 +1,416 @@
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "fleet_aggregator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "autopilot_interface.h"
+
+
+// ----------------------------------------------------------------------------------
+//   Fleet Aggregator Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Fleet_Aggregator::
+Fleet_Aggregator(UDP_Port *port_, InfluxDB_Interface &sinks_) :
+	sinks(sinks_)
+{
+	port = port_;
+
+	workers   = 4;
+	listeners = 0;
+	queue_len = 1024;
+
+	receive_tid    = 0;
+	time_to_exit   = false;
+	workers_exit   = false;
+	datagram_count = 0;
+
+	// wakes the receive thread up on shutdown
+	exit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if ( exit_fd < 0 )
+	{
+		fprintf(stderr,"ERROR: could not create eventfd\n");
+		throw 1;
+	}
+}
+
+Fleet_Aggregator::
+~Fleet_Aggregator()
+{
+	stop();
+	close(exit_fd);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Start / Stop
+// ------------------------------------------------------------------------------
+void
+Fleet_Aggregator::
+start()
+{
+	if ( !port->is_running() )
+	{
+		fprintf(stderr,"ERROR: port not open\n");
+		throw 1;
+	}
+
+	if ( listeners > 0 )
+	{
+		workers = listeners;
+	}
+	if ( workers < 1 )
+	{
+		workers = 1;
+	}
+
+	for ( int i = 0; i < workers; i++ )
+	{
+		// listeners read their socket, the queue is never used
+		Fleet_Worker *worker = new Fleet_Worker(listeners > 0 ? 1 : queue_len);
+		worker->fleet         = this;
+		worker->index         = i;
+		worker->message_count = 0;
+		worker->port          = NULL;
+
+		worker->influx = new InfluxDB_Interface("", 0);
+		worker->influx->attach(sinks);
+
+		if ( listeners > 0 )
+		{
+			// the first listener is the port we were given
+			if ( i == 0 )
+			{
+				worker->port = port;
+			}
+			else
+			{
+				worker->port = new UDP_Port(port->get_target_ip(), port->get_rx_port());
+				worker->port->rcvbuf_size = port->rcvbuf_size;
+				worker->port->reuse_port  = true;
+				worker->port->start();
+			}
+		}
+
+		pool.push_back(worker);
+	}
+
+	for ( Fleet_Worker *worker : pool )
+	{
+		int result = pthread_create(&worker->tid, NULL,
+		                            worker->port ? &start_fleet_listener_thread : &start_fleet_worker_thread, worker);
+		if ( result ) throw result;
+	}
+
+	if ( listeners > 0 )
+	{
+		printf("[INFO] Fleet aggregator started, %d listeners.\n", workers);
+		return;
+	}
+
+	int result = pthread_create(&receive_tid, NULL, &start_fleet_receive_thread, this);
+	if ( result ) throw result;
+
+	printf("[INFO] Fleet aggregator started, %d workers.\n", workers);
+}
+
+void
+Fleet_Aggregator::
+stop()
+{
+	if ( pool.empty() )
+	{
+		return;
+	}
+
+	time_to_exit = true;
+
+	uint64_t one = 1;
+	if ( write(exit_fd, &one, sizeof(one)) < 0 )
+	{
+		perror("error waking the receive thread");
+	}
+
+	if ( receive_tid )
+	{
+		pthread_join(receive_tid, NULL);
+		receive_tid = 0;
+	}
+
+	// nothing is queued anymore, the workers drain their queues and hand
+	// what they hold to the writers, which are still running
+	workers_exit = true;
+	for ( Fleet_Worker *worker : pool )
+	{
+		pthread_join(worker->tid, NULL);
+	}
+
+	print_stats();
+
+	for ( Fleet_Worker *worker : pool )
+	{
+		if ( worker->port && worker->port != port )
+		{
+			worker->port->stop();
+			delete worker->port;
+		}
+		delete worker->influx;
+		delete worker;
+	}
+	pool.clear();
+}
+
+void
+Fleet_Aggregator::
+print_stats()
+{
+	uint64_t messages = 0;
+	uint64_t dropped  = 0;
+
+	for ( Fleet_Worker *worker : pool )
+	{
+		messages += worker->message_count;
+		dropped  += worker->queue.dropped();
+	}
+
+	// the spread over the listeners is up to the kernel, show it
+	if ( listeners > 0 )
+	{
+		for ( Fleet_Worker *worker : pool )
+		{
+			printf("[INFO] Listener %d: %llu datagrams, %llu bytes, %llu dropped by the kernel, %llu messages.\n",
+			       worker->index,
+			       (unsigned long long)worker->port->rx_packets.load(),
+			       (unsigned long long)worker->port->rx_bytes.load(),
+			       (unsigned long long)worker->port->rx_dropped.load(),
+			       (unsigned long long)worker->message_count.load());
+		}
+		return;
+	}
+
+	printf("[INFO] Fleet: %llu datagrams, %llu messages, %llu datagrams dropped by busy workers.\n",
+	       (unsigned long long)datagram_count.load(), (unsigned long long)messages, (unsigned long long)dropped);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Receive Thread
+// ------------------------------------------------------------------------------
+void
+Fleet_Aggregator::
+receive_thread()
+{
+	port->set_blocking(false);
+
+	struct pollfd fds[2];
+	fds[0].fd     = port->get_fd();
+	fds[0].events = POLLIN;
+	fds[1].fd     = exit_fd;
+	fds[1].events = POLLIN;
+
+	while ( !time_to_exit )
+	{
+		int n = poll(fds, 2, -1);
+		if ( n < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+
+			perror("error poll failed");
+			break;
+		}
+
+		if ( fds[0].revents & (POLLERR | POLLNVAL) )
+		{
+			fprintf(stderr,"ERROR: port closed, stopping receive thread\n");
+			break;
+		}
+
+		// drain the socket, recvmmsg takes up to a burst per call
+		while ( !time_to_exit && port->read_datagrams([&](const uint8_t *data, size_t len) {
+
+			Fleet_Worker *worker = pool[_shard(data, len)];
+
+			Fleet_Frame *frame = worker->queue.claim();
+			if ( frame == NULL )
+			{
+				return;
+			}
+
+			frame->time_usec = get_time_usec();
+			frame->len       = len;
+			memcpy(frame->data, data, len);
+			worker->queue.publish();
+
+			datagram_count++;
+
+		}) > 0 );
+	}
+
+	port->set_blocking(true);
+}
+
+// worker of a datagram, by the sysid of its first frame
+int
+Fleet_Aggregator::
+_shard(const uint8_t *data, size_t len)
+{
+	for ( size_t i = 0; i < len; i++ )
+	{
+		// sysid is the 6th byte of a MAVLink 2 header, the 4th of MAVLink 1
+		if ( data[i] == MAVLINK_STX && i + 5 < len )
+		{
+			return data[i + 5] % workers;
+		}
+		if ( data[i] == MAVLINK_STX_MAVLINK1 && i + 3 < len )
+		{
+			return data[i + 3] % workers;
+		}
+	}
+
+	return 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Worker Thread
+// ------------------------------------------------------------------------------
+void
+Fleet_Aggregator::
+worker_thread(Fleet_Worker &worker)
+{
+	InfluxDB_Interface &influx = *worker.influx;
+	Mavlink_Event event;
+
+	auto handle = [&](const mavlink_message_t &message) {
+		event.message = message;
+		influx.pushMessage(event);
+		worker.message_count++;
+	};
+
+	while ( true )
+	{
+		bool exiting = workers_exit;
+
+		if ( worker.queue.wait(influx.flush_interval_ms) )
+		{
+			Fleet_Frame *frame;
+			while ( (frame = worker.queue.front()) != NULL )
+			{
+				event.time_usec = frame->time_usec;
+				worker.parser.parse(frame->data, frame->len, handle);
+				worker.queue.release();
+			}
+		}
+
+		influx.flushDue();
+
+		// the receive thread was gone before this last pass
+		if ( exiting )
+		{
+			break;
+		}
+	}
+
+	influx.flushAll();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Listener Thread
+// ------------------------------------------------------------------------------
+void
+Fleet_Aggregator::
+listener_thread(Fleet_Worker &worker)
+{
+	InfluxDB_Interface &influx = *worker.influx;
+	UDP_Port &listener = *worker.port;
+	Mavlink_Event event;
+
+	auto handle = [&](const mavlink_message_t &message) {
+		event.message = message;
+		influx.pushMessage(event);
+		worker.message_count++;
+	};
+
+	auto receive = [&](const uint8_t *data, size_t len) {
+		event.time_usec = get_time_usec();
+		worker.parser.parse(data, len, handle);
+	};
+
+	listener.set_blocking(false);
+
+	struct pollfd fds[2];
+	fds[0].fd     = listener.get_fd();
+	fds[0].events = POLLIN;
+	fds[1].fd     = exit_fd;
+	fds[1].events = POLLIN;
+
+	while ( !time_to_exit )
+	{
+		int n = poll(fds, 2, influx.flush_interval_ms);
+		if ( n < 0 && errno != EINTR )
+		{
+			perror("error poll failed");
+			break;
+		}
+
+		if ( n > 0 && (fds[0].revents & (POLLERR | POLLNVAL)) )
+		{
+			fprintf(stderr,"ERROR: port closed, stopping listener %d\n", worker.index);
+			break;
+		}
+
+		// drain the socket, recvmmsg takes up to a burst per call
+		if ( n > 0 && (fds[0].revents & POLLIN) )
+		{
+			while ( !time_to_exit && listener.read_datagrams(receive) > 0 );
+		}
+
+		influx.flushDue();
+	}
+
+	listener.set_blocking(true);
+
+	influx.flushAll();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Pthread Starter Helper Functions
+// ------------------------------------------------------------------------------
+void*
+start_fleet_receive_thread(void *args)
+{
+	Fleet_Aggregator *fleet = (Fleet_Aggregator *)args;
+	fleet->receive_thread();
+	return NULL;
+}
+
+void*
+start_fleet_worker_thread(void *args)
+{
+	Fleet_Worker *worker = (Fleet_Worker *)args;
+	worker->fleet->worker_thread(*worker);
+	return NULL;
+}
+
+void*
+start_fleet_listener_thread(void *args)
+{
+	Fleet_Worker *worker = (Fleet_Worker *)args;
+	worker->fleet->listener_thread(*worker);
+	return NULL;
+}
@@ -0,0 +1,136 @@
+#ifndef FLEET_AGGREGATOR_H_
+#define FLEET_AGGREGATOR_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+
+#include "udp_port.h"
+#include "mavlink_parser.h"
+#include "message_queue.h"
+#include "influxdb_interface.h"
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// one datagram, as handed from the receive thread to a worker
+struct Fleet_Frame
+{
+	uint64_t time_usec;
+	uint16_t len;
+	uint8_t  data[UDP_Port::BUFF_LEN];
+};
+
+class Fleet_Aggregator;
+
+// everything one worker thread owns
+struct Fleet_Worker
+{
+	Fleet_Worker(size_t queue_len) : queue(queue_len) {}
+
+	Fleet_Aggregator *fleet;
+	int index;
+	pthread_t tid;
+
+	Message_Queue<Fleet_Frame> queue;
+	Mavlink_Parser parser;
+
+	// the worker's own SO_REUSEPORT socket in listener mode, read instead
+	// of the queue; NULL when fed by the receive thread
+	UDP_Port *port;
+
+	// batches, decimation and rollups of the vehicles of this worker
+	InfluxDB_Interface *influx;
+
+	std::atomic<uint64_t> message_count;
+};
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+void* start_fleet_receive_thread(void *args);
+void* start_fleet_worker_thread(void *args);
+void* start_fleet_listener_thread(void *args);
+
+
+// ----------------------------------------------------------------------------------
+//   Fleet Aggregator Class
+// ----------------------------------------------------------------------------------
+/*
+ * Fleet Aggregator Class
+ *
+ * Ingests the telemetry of many vehicles sharing one UDP port. A receive
+ * thread pulls datagrams off the socket in bursts and hands each one, still
+ * undecoded, to one of the worker threads, chosen by the sysid of its first
+ * frame. All traffic of a vehicle goes through the same worker, in order.
+ *
+ * Each worker has its own queue, parser and InfluxDB_Interface, so decoding,
+ * decimation, rollups and batch building run without any shared state. The
+ * batches all go to the writer threads (or UDP socket) of the interface the
+ * aggregator was given.
+ *
+ * A worker that falls behind loses datagrams when its queue is full, they are
+ * counted. Vehicles are spread by sysid modulo the worker count.
+ *
+ * When one receive thread can't keep up, listener mode leaves the spreading
+ * to the kernel: every worker binds its own SO_REUSEPORT socket to the port
+ * and reads, decodes and batches on its own. Senders are hashed over the
+ * sockets by address, so a vehicle still always lands on the same worker.
+ * The port given must have reuse_port set before it was started.
+ */
+class Fleet_Aggregator
+{
+
+public:
+
+	Fleet_Aggregator(UDP_Port *port_, InfluxDB_Interface &sinks_);
+	~Fleet_Aggregator();
+
+	// set before start(), listeners > 0 replaces the workers
+	int workers;
+	int listeners;
+	size_t queue_len;
+
+	void start();
+
+	// joins the workers once their batches went to the writers, which the
+	// caller stops afterwards to get them sent
+	void stop();
+
+	void print_stats();
+
+	void receive_thread();
+	void worker_thread(Fleet_Worker &worker);
+	void listener_thread(Fleet_Worker &worker);
+
+private:
+
+	UDP_Port *port;
+	InfluxDB_Interface &sinks;
+
+	std::vector<Fleet_Worker *> pool;
+	pthread_t receive_tid;
+
+	std::atomic<bool> time_to_exit;
+	std::atomic<bool> workers_exit;
+	int exit_fd;
+
+	std::atomic<uint64_t> datagram_count;
+
+	int _shard(const uint8_t *data, size_t len);
+
+};
+
+
+
+#endif // FLEET_AGGREGATOR_H_
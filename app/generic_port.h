@@ -7,6 +7,8 @@
 
 #include <common/mavlink.h>
 
+#include "mavlink_parser.h"
+
 // ------------------------------------------------------------------------------
 //   Defines
 // ------------------------------------------------------------------------------
@@ -29,8 +31,11 @@ public:
 	Generic_Port(){};
 	virtual ~Generic_Port(){};
 	virtual int read_message(mavlink_message_t &message)=0;
+	virtual int read_messages(const Message_Callback &callback)=0;
 	virtual int write_message(const mavlink_message_t &message)=0;
 	virtual bool is_running()=0;
+	virtual int  get_fd()=0;
+	virtual void set_blocking(bool blocking)=0;
 	virtual void start()=0;
 	virtual void stop()=0;
 };
@@ -0,0 +1,665 @@
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "http_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <algorithm>
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+
+static uint64_t
+now_ms()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// waits until fd is ready for events, false on timeout or poll error
+static bool
+wait_fd(int fd, short events, uint64_t deadline, const char *&error)
+{
+	uint64_t now = now_ms();
+	if ( now >= deadline )
+	{
+		error = "timed out";
+		return false;
+	}
+
+	struct pollfd pfd;
+	pfd.fd      = fd;
+	pfd.events  = events;
+	pfd.revents = 0;
+
+	int result = poll(&pfd, 1, (int)(deadline - now));
+	if ( result == 0 )
+	{
+		error = "timed out";
+		return false;
+	}
+	if ( result < 0 && errno != EINTR )
+	{
+		error = strerror(errno);
+		return false;
+	}
+
+	// errors and hang ups show up on the next read or write
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Response Reader
+// ------------------------------------------------------------------------------
+
+struct Http_Reader
+{
+	int fd;
+	uint64_t deadline;
+
+	char   buf[4096];
+	size_t start;
+	size_t end;
+
+	bool eof;
+	bool answered;
+	const char *error;
+};
+
+// reads more bytes, false on error, timeout or end of stream
+static bool
+reader_fill(Http_Reader &r)
+{
+	if ( r.start > 0 )
+	{
+		memmove(r.buf, r.buf + r.start, r.end - r.start);
+		r.end  -= r.start;
+		r.start = 0;
+	}
+
+	if ( r.end == sizeof(r.buf) )
+	{
+		r.error = "response line too long";
+		return false;
+	}
+
+	while ( true )
+	{
+		ssize_t n = recv(r.fd, r.buf + r.end, sizeof(r.buf) - r.end, 0);
+		if ( n > 0 )
+		{
+			r.end     += n;
+			r.answered = true;
+			return true;
+		}
+		if ( n == 0 )
+		{
+			r.eof   = true;
+			r.error = "connection closed by server";
+			return false;
+		}
+		if ( errno == EINTR )
+		{
+			continue;
+		}
+		if ( errno != EAGAIN && errno != EWOULDBLOCK )
+		{
+			r.error = strerror(errno);
+			return false;
+		}
+		if ( !wait_fd(r.fd, POLLIN, r.deadline, r.error) )
+		{
+			return false;
+		}
+	}
+}
+
+// next line without its CRLF, NUL terminated, valid until the next call
+static bool
+reader_line(Http_Reader &r, char *&line, size_t &len)
+{
+	while ( true )
+	{
+		char *nl = (char *)memchr(r.buf + r.start, '\n', r.end - r.start);
+		if ( nl )
+		{
+			line = r.buf + r.start;
+			len  = nl - line;
+			if ( len > 0 && line[len - 1] == '\r' )
+			{
+				len--;
+			}
+			line[len] = '\0';
+
+			r.start = nl - r.buf + 1;
+			return true;
+		}
+
+		if ( !reader_fill(r) )
+		{
+			return false;
+		}
+	}
+}
+
+static bool
+reader_skip(Http_Reader &r, uint64_t n)
+{
+	while ( n > 0 )
+	{
+		if ( r.start == r.end && !reader_fill(r) )
+		{
+			return false;
+		}
+
+		size_t take = (size_t)std::min<uint64_t>(r.end - r.start, n);
+		r.start += take;
+		n       -= take;
+	}
+
+	return true;
+}
+
+
+// ----------------------------------------------------------------------------------
+//   HTTP Client Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Http_Client::
+Http_Client()
+{
+	connect_timeout_ms = 2000;
+	request_timeout_ms = 10000;
+	idle_timeout_ms    = 60000;
+	max_idle           = 4;
+
+	port     = 0;
+	addr_len = 0;
+	memset(&addr, 0, sizeof(addr));
+}
+
+Http_Client::
+~Http_Client()
+{
+	close_all();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Configuration
+// ------------------------------------------------------------------------------
+void
+Http_Client::
+set_server(const std::string &host_, int port_)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	host     = host_;
+	port     = port_;
+	addr_len = 0;
+
+	// resolved on the first connection
+}
+
+void
+Http_Client::
+close_all()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for ( Idle_Connection &connection : idle )
+	{
+		close(connection.fd);
+	}
+	idle.clear();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Post
+// ------------------------------------------------------------------------------
+int
+Http_Client::
+post(const char *path, const char *headers, const void *body, size_t len, const char *&error)
+{
+	uint64_t deadline = now_ms() + request_timeout_ms;
+
+	// a second go only if a pooled connection turned out to be dead
+	for ( int attempt = 0; attempt < 2; attempt++ )
+	{
+		bool reused = false;
+		int fd = _acquire(deadline, reused, error);
+		if ( fd < 0 )
+		{
+			return -1;
+		}
+
+		bool keep_alive = false;
+		bool answered   = false;
+		int  status     = -1;
+
+		if ( _send_request(fd, path, headers, body, len, deadline, error) )
+		{
+			status = _read_response(fd, deadline, keep_alive, answered, error);
+		}
+
+		if ( status > 0 )
+		{
+			_release(fd, keep_alive);
+			return status;
+		}
+
+		close(fd);
+
+		if ( !reused || answered || now_ms() >= deadline )
+		{
+			break;
+		}
+	}
+
+	return -1;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions - Connection Pool
+// ------------------------------------------------------------------------------
+int
+Http_Client::
+_acquire(uint64_t deadline, bool &reused, const char *&error)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		uint64_t now = now_ms();
+
+		// most recently used first, it is the least likely to be closed
+		while ( !idle.empty() )
+		{
+			Idle_Connection connection = idle.back();
+			idle.pop_back();
+
+			if ( now - connection.since_ms >= (uint64_t)idle_timeout_ms )
+			{
+				close(connection.fd);
+				continue;
+			}
+
+			// an idle connection has nothing to read unless the server closed it
+			struct pollfd pfd;
+			pfd.fd      = connection.fd;
+			pfd.events  = POLLIN;
+			pfd.revents = 0;
+			if ( poll(&pfd, 1, 0) != 0 )
+			{
+				close(connection.fd);
+				continue;
+			}
+
+			reused = true;
+			return connection.fd;
+		}
+	}
+
+	reused = false;
+	return _connect(deadline, error);
+}
+
+void
+Http_Client::
+_release(int fd, bool keep)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if ( !keep || idle.size() >= max_idle )
+	{
+		close(fd);
+		return;
+	}
+
+	Idle_Connection connection;
+	connection.fd       = fd;
+	connection.since_ms = now_ms();
+	idle.push_back(connection);
+}
+
+bool
+Http_Client::
+_resolve(const char *&error)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	char service[16];
+	snprintf(service, sizeof(service), "%d", port);
+
+	struct addrinfo *result = NULL;
+	int rc = getaddrinfo(host.c_str(), service, &hints, &result);
+	if ( rc != 0 || result == NULL )
+	{
+		error = rc == EAI_SYSTEM ? strerror(errno) : gai_strerror(rc);
+		return false;
+	}
+
+	memcpy(&addr, result->ai_addr, result->ai_addrlen);
+	addr_len = result->ai_addrlen;
+
+	freeaddrinfo(result);
+	return true;
+}
+
+int
+Http_Client::
+_connect(uint64_t deadline, const char *&error)
+{
+	struct sockaddr_storage target;
+	socklen_t target_len;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if ( addr_len == 0 && !_resolve(error) )
+		{
+			return -1;
+		}
+		target     = addr;
+		target_len = addr_len;
+	}
+
+	int fd = socket(target.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if ( fd < 0 )
+	{
+		error = strerror(errno);
+		return -1;
+	}
+
+	// requests are written in one go, don't hold back the last segment
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+
+	if ( connect(fd, (struct sockaddr *)&target, target_len) < 0 )
+	{
+		if ( errno != EINPROGRESS )
+		{
+			error = strerror(errno);
+			close(fd);
+			return -1;
+		}
+
+		uint64_t connect_deadline = std::min(deadline, now_ms() + connect_timeout_ms);
+		if ( !wait_fd(fd, POLLOUT, connect_deadline, error) )
+		{
+			close(fd);
+			return -1;
+		}
+
+		int so_error = 0;
+		socklen_t so_len = sizeof(so_error);
+		getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &so_len);
+		if ( so_error )
+		{
+			error = strerror(so_error);
+			close(fd);
+			return -1;
+		}
+	}
+
+	return fd;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Send Request
+// ------------------------------------------------------------------------------
+bool
+Http_Client::
+_send_request(int fd, const char *path, const char *headers, const void *body, size_t len,
+              uint64_t deadline, const char *&error)
+{
+	char head[1024];
+	int head_len = snprintf(head, sizeof(head),
+		"POST %s HTTP/1.1\r\n"
+		"Host: %s:%d\r\n"
+		"Content-Length: %zu\r\n"
+		"%s"
+		"\r\n",
+		path, host.c_str(), port, len, headers ? headers : "");
+
+	if ( head_len < 0 || (size_t)head_len >= sizeof(head) )
+	{
+		error = "request header too long";
+		return false;
+	}
+
+	// header and body go out together, the body is not copied
+	struct iovec iov[2];
+	iov[0].iov_base = head;
+	iov[0].iov_len  = head_len;
+	iov[1].iov_base = (void *)body;
+	iov[1].iov_len  = len;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov    = iov;
+	msg.msg_iovlen = 2;
+
+	while ( msg.msg_iovlen > 0 )
+	{
+		ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if ( sent < 0 )
+		{
+			if ( errno == EINTR )
+			{
+				continue;
+			}
+			if ( errno != EAGAIN && errno != EWOULDBLOCK )
+			{
+				error = strerror(errno);
+				return false;
+			}
+			if ( !wait_fd(fd, POLLOUT, deadline, error) )
+			{
+				return false;
+			}
+			continue;
+		}
+
+		// drop what was written from the front of the vector
+		while ( msg.msg_iovlen > 0 && (size_t)sent >= msg.msg_iov[0].iov_len )
+		{
+			sent -= msg.msg_iov[0].iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if ( msg.msg_iovlen > 0 )
+		{
+			msg.msg_iov[0].iov_base = (char *)msg.msg_iov[0].iov_base + sent;
+			msg.msg_iov[0].iov_len -= sent;
+		}
+	}
+
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Read Response
+// ------------------------------------------------------------------------------
+// returns the status, or -1 with error set
+int
+Http_Client::
+_read_response(int fd, uint64_t deadline, bool &keep_alive, bool &answered, const char *&error)
+{
+	Http_Reader r;
+	r.fd       = fd;
+	r.deadline = deadline;
+	r.start    = 0;
+	r.end      = 0;
+	r.eof      = false;
+	r.answered = false;
+	r.error    = NULL;
+
+	char  *line;
+	size_t len;
+
+	// --------------------------------------------------------------------------
+	//   STATUS LINE
+	// --------------------------------------------------------------------------
+	if ( !reader_line(r, line, len) )
+	{
+		answered = r.answered;
+		error    = r.error;
+		return -1;
+	}
+	answered = true;
+
+	if ( len < 12 || strncmp(line, "HTTP/1.", 7) != 0 )
+	{
+		error = "bad status line";
+		return -1;
+	}
+
+	int status = atoi(line + 9);
+	keep_alive = line[7] != '0';
+
+	// --------------------------------------------------------------------------
+	//   HEADERS
+	// --------------------------------------------------------------------------
+	int64_t content_length = -1;
+	bool    chunked        = false;
+
+	while ( true )
+	{
+		if ( !reader_line(r, line, len) )
+		{
+			error = r.error;
+			return -1;
+		}
+		if ( len == 0 )
+		{
+			break;
+		}
+
+		char *value = strchr(line, ':');
+		if ( value == NULL )
+		{
+			continue;
+		}
+		*value++ = '\0';
+		while ( *value == ' ' || *value == '\t' )
+		{
+			value++;
+		}
+
+		if ( strcasecmp(line, "Content-Length") == 0 )
+		{
+			content_length = strtoll(value, NULL, 10);
+		}
+		else if ( strcasecmp(line, "Transfer-Encoding") == 0 )
+		{
+			chunked = strcasestr(value, "chunked") != NULL;
+		}
+		else if ( strcasecmp(line, "Connection") == 0 )
+		{
+			if ( strcasestr(value, "close") )
+				keep_alive = false;
+			else if ( strcasestr(value, "keep-alive") )
+				keep_alive = true;
+		}
+	}
+
+	// --------------------------------------------------------------------------
+	//   BODY, READ AND DROPPED
+	// --------------------------------------------------------------------------
+	if ( status == 204 || status == 304 || (status >= 100 && status < 200) )
+	{
+		// no body
+	}
+	else if ( chunked )
+	{
+		while ( true )
+		{
+			if ( !reader_line(r, line, len) )
+			{
+				error = r.error;
+				return -1;
+			}
+
+			uint64_t chunk = strtoull(line, NULL, 16);
+			if ( chunk == 0 )
+			{
+				break;
+			}
+
+			// chunk and its CRLF
+			if ( !reader_skip(r, chunk + 2) )
+			{
+				error = r.error;
+				return -1;
+			}
+		}
+
+		// trailers up to the empty line
+		do
+		{
+			if ( !reader_line(r, line, len) )
+			{
+				error = r.error;
+				return -1;
+			}
+		}
+		while ( len > 0 );
+	}
+	else if ( content_length >= 0 )
+	{
+		if ( !reader_skip(r, content_length) )
+		{
+			error = r.error;
+			return -1;
+		}
+	}
+	else
+	{
+		// body ends with the connection
+		keep_alive = false;
+		while ( reader_fill(r) )
+		{
+			r.start = r.end;
+		}
+		if ( !r.eof )
+		{
+			error = r.error;
+			return -1;
+		}
+	}
+
+	// a pipelined or stray byte would confuse the next request
+	if ( r.start != r.end )
+	{
+		keep_alive = false;
+	}
+
+	return status;
+}
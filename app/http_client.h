@@ -0,0 +1,88 @@
+#ifndef HTTP_CLIENT_H_
+#define HTTP_CLIENT_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// ----------------------------------------------------------------------------------
+//   HTTP Client Class
+// ----------------------------------------------------------------------------------
+/*
+ * HTTP Client Class
+ *
+ * Just enough HTTP/1.1 to POST request bodies to one server and read back the
+ * status. Connections are kept alive and pooled, any number of threads can
+ * post at the same time, each takes a connection from the pool or opens a new
+ * one. Sockets are non-blocking and every request has a hard deadline that
+ * covers connecting, sending and reading the answer.
+ *
+ * A pooled connection the server has closed meanwhile is detected when the
+ * request gets no answer at all, the request is then sent once more on a new
+ * connection. Response bodies are read (Content-Length or chunked) and thrown
+ * away.
+ */
+class Http_Client
+{
+
+public:
+
+	Http_Client();
+	~Http_Client();
+
+	Http_Client(const Http_Client &) = delete;
+	Http_Client &operator=(const Http_Client &) = delete;
+
+	// set before the first request
+	int connect_timeout_ms;
+	int request_timeout_ms;
+	int idle_timeout_ms;
+	size_t max_idle;
+
+	void set_server(const std::string &host, int port);
+
+	// headers are extra header lines, each ending with "\r\n"
+	// returns the HTTP status, or -1 with error set
+	int post(const char *path, const char *headers, const void *body, size_t len, const char *&error);
+
+	void close_all();
+
+private:
+
+	struct Idle_Connection
+	{
+		int fd;
+		uint64_t since_ms;
+	};
+
+	std::string host;
+	int port;
+
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+
+	std::vector<Idle_Connection> idle;
+	std::mutex mutex;
+
+	bool _resolve(const char *&error);
+	int  _acquire(uint64_t deadline, bool &reused, const char *&error);
+	void _release(int fd, bool keep);
+	int  _connect(uint64_t deadline, const char *&error);
+
+	bool _send_request(int fd, const char *path, const char *headers, const void *body, size_t len,
+	                   uint64_t deadline, const char *&error);
+	int  _read_response(int fd, uint64_t deadline, bool &keep_alive, bool &answered, const char *&error);
+
+};
+
+
+
+#endif // HTTP_CLIENT_H_
@@ -0,0 +1,453 @@
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "influx_spool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+#define SPOOL_MAGIC  0x4c4f4f50  // "POOL", waiting to be sent
+#define SPOOL_SENT   0x544e4553  // "SENT"
+
+#define SPOOL_HEADER_LEN 16
+
+// header fields, 32 bits each
+#define SPOOL_MAGIC_OFF  0
+#define SPOOL_DB_OFF     4
+#define SPOOL_POINTS_OFF 8
+#define SPOOL_SIZE_OFF   12
+
+static inline uint32_t *
+spool_field(uint8_t *record, size_t off)
+{
+	return (uint32_t *)(record + off);
+}
+
+static inline size_t
+spool_record_len(size_t body)
+{
+	return SPOOL_HEADER_LEN + ((body + 7) & ~(size_t)7);
+}
+
+
+// ----------------------------------------------------------------------------------
+//   Influx Spool Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Influx_Spool::
+Influx_Spool()
+{
+	segment_size = 16 * 1024 * 1024;
+	disk_budget  = 1024ULL * 1024 * 1024;
+
+	is_open  = false;
+	next_seq = 0;
+
+	spooled_count = 0;
+	drop_count    = 0;
+}
+
+Influx_Spool::
+~Influx_Spool()
+{
+	close();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Open / Close
+// ------------------------------------------------------------------------------
+// throws EXIT_FAILURE if the directory can't be used
+void
+Influx_Spool::
+open()
+{
+	if ( directory.empty() || is_open )
+	{
+		return;
+	}
+
+	if ( mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST )
+	{
+		printf("[ERROR] Can't create spool directory %s: %s\n", directory.c_str(), strerror(errno));
+		throw EXIT_FAILURE;
+	}
+
+	DIR *dir = opendir(directory.c_str());
+	if ( dir == NULL )
+	{
+		printf("[ERROR] Can't open spool directory %s: %s\n", directory.c_str(), strerror(errno));
+		throw EXIT_FAILURE;
+	}
+
+	// segments left by a previous run, replayed oldest first
+	std::vector<uint64_t> found;
+	struct dirent *entry;
+	while ( (entry = readdir(dir)) != NULL )
+	{
+		unsigned long long seq;
+		char tail;
+		if ( sscanf(entry->d_name, "spool-%llu.se%c", &seq, &tail) == 2 && tail == 'g' )
+		{
+			found.push_back(seq);
+		}
+	}
+	closedir(dir);
+
+	std::sort(found.begin(), found.end());
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for ( uint64_t seq : found )
+	{
+		Segment segment;
+		segment.seq = seq;
+
+		if ( !_map(segment, false) )
+		{
+			continue;
+		}
+
+		_scan(segment);
+		segments.push_back(segment);
+		next_seq = seq + 1;
+	}
+
+	is_open = true;
+
+	if ( !segments.empty() )
+	{
+		printf("[INFO] Found %zu spool segments in %s.\n", segments.size(), directory.c_str());
+	}
+}
+
+void
+Influx_Spool::
+close()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for ( Segment &segment : segments )
+	{
+		munmap(segment.base, segment.size);
+		::close(segment.fd);
+	}
+	segments.clear();
+
+	is_open = false;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Append
+// ------------------------------------------------------------------------------
+bool
+Influx_Spool::
+append(int db, const Line_Buffer &lines)
+{
+	if ( !is_open || lines.empty() )
+	{
+		return false;
+	}
+
+	size_t needed = spool_record_len(lines.size());
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if ( segments.empty() || !segments.back().writable || segments.back().size - segments.back().write_pos < needed )
+	{
+		if ( !_rotate(needed) )
+		{
+			return false;
+		}
+	}
+
+	Segment &segment = segments.back();
+	uint8_t *record  = segment.base + segment.write_pos;
+
+	memcpy(record + SPOOL_HEADER_LEN, lines.data(), lines.size());
+	*spool_field(record, SPOOL_DB_OFF)     = db;
+	*spool_field(record, SPOOL_POINTS_OFF) = lines.points();
+	*spool_field(record, SPOOL_SIZE_OFF)   = lines.size();
+
+	// magic last, a record cut short is never read back
+	__atomic_store_n(spool_field(record, SPOOL_MAGIC_OFF), SPOOL_MAGIC, __ATOMIC_RELEASE);
+
+	segment.write_pos += needed;
+	spooled_count     += lines.points();
+
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Read Back
+// ------------------------------------------------------------------------------
+bool
+Influx_Spool::
+peek(int &db, Line_Buffer &lines, Spool_Position &position)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	while ( !segments.empty() )
+	{
+		Segment &segment = segments.front();
+		_skip_sent(segment);
+
+		if ( segment.read_pos < segment.write_pos )
+		{
+			uint8_t *record = segment.base + segment.read_pos;
+
+			db = *spool_field(record, SPOOL_DB_OFF);
+			lines.clear();
+			lines.append_lines((const char *)record + SPOOL_HEADER_LEN,
+			                   *spool_field(record, SPOOL_SIZE_OFF),
+			                   *spool_field(record, SPOOL_POINTS_OFF));
+
+			position.segment = segment.seq;
+			position.offset  = segment.read_pos;
+			return true;
+		}
+
+		// the segment being written stays, older ones are done
+		if ( segments.size() == 1 )
+		{
+			break;
+		}
+		_remove_front();
+	}
+
+	return false;
+}
+
+void
+Influx_Spool::
+consume(const Spool_Position &position)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// the segment may have been evicted meanwhile
+	for ( Segment &segment : segments )
+	{
+		if ( segment.seq != position.segment )
+		{
+			continue;
+		}
+
+		uint32_t *magic = spool_field(segment.base + position.offset, SPOOL_MAGIC_OFF);
+		if ( *magic == SPOOL_MAGIC )
+		{
+			*magic = SPOOL_SENT;
+		}
+		_skip_sent(segment);
+		break;
+	}
+
+	if ( segments.size() > 1 && segments.front().read_pos >= segments.front().write_pos )
+	{
+		_remove_front();
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+// all called with the mutex held
+
+std::string
+Influx_Spool::
+_path(uint64_t seq)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/spool-%020llu.seg", (unsigned long long)seq);
+	return directory + name;
+}
+
+bool
+Influx_Spool::
+_map(Segment &segment, bool create)
+{
+	std::string path = _path(segment.seq);
+
+	segment.fd = ::open(path.c_str(), O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+	if ( segment.fd < 0 )
+	{
+		printf("[ERROR] Can't open spool segment %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	// the disk space is taken up front, a full disk fails here instead of
+	// raising SIGBUS on a write to the mapping
+	if ( create )
+	{
+		int error = posix_fallocate(segment.fd, 0, segment.size);
+		if ( error )
+		{
+			printf("[ERROR] Can't allocate spool segment %s: %s\n", path.c_str(), strerror(error));
+			::close(segment.fd);
+			unlink(path.c_str());
+			return false;
+		}
+	}
+
+	if ( !create )
+	{
+		struct stat st;
+		if ( fstat(segment.fd, &st) < 0 || (size_t)st.st_size < SPOOL_HEADER_LEN )
+		{
+			::close(segment.fd);
+			unlink(path.c_str());
+			return false;
+		}
+		segment.size = st.st_size;
+	}
+
+	void *base = mmap(NULL, segment.size, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0);
+	if ( base == MAP_FAILED )
+	{
+		printf("[ERROR] Can't map spool segment %s: %s\n", path.c_str(), strerror(errno));
+		::close(segment.fd);
+		return false;
+	}
+
+	segment.base      = (uint8_t *)base;
+	segment.read_pos  = 0;
+	segment.write_pos = 0;
+	segment.writable  = create;
+
+	return true;
+}
+
+// finds the end of the records in a segment from a previous run
+void
+Influx_Spool::
+_scan(Segment &segment)
+{
+	size_t pos = 0;
+
+	while ( pos + SPOOL_HEADER_LEN <= segment.size )
+	{
+		uint8_t *record = segment.base + pos;
+		uint32_t magic  = *spool_field(record, SPOOL_MAGIC_OFF);
+
+		if ( magic != SPOOL_MAGIC && magic != SPOOL_SENT )
+		{
+			break;
+		}
+
+		size_t len = spool_record_len(*spool_field(record, SPOOL_SIZE_OFF));
+		if ( pos + len > segment.size )
+		{
+			break;
+		}
+
+		pos += len;
+	}
+
+	segment.write_pos = pos;
+	_skip_sent(segment);
+}
+
+void
+Influx_Spool::
+_skip_sent(Segment &segment)
+{
+	while ( segment.read_pos < segment.write_pos )
+	{
+		uint8_t *record = segment.base + segment.read_pos;
+		if ( *spool_field(record, SPOOL_MAGIC_OFF) != SPOOL_SENT )
+		{
+			break;
+		}
+
+		segment.read_pos += spool_record_len(*spool_field(record, SPOOL_SIZE_OFF));
+	}
+}
+
+// starts a segment with room for needed bytes, evicting old ones over budget
+bool
+Influx_Spool::
+_rotate(size_t needed)
+{
+	Segment segment;
+	segment.seq  = next_seq++;
+	segment.size = std::max(segment_size, needed);
+
+	uint64_t used = segment.size;
+	for ( const Segment &old : segments )
+	{
+		used += old.size;
+	}
+
+	while ( used > disk_budget && !segments.empty() )
+	{
+		used -= segments.front().size;
+		_remove_front();
+	}
+
+	if ( used > disk_budget )
+	{
+		printf("[WARNING] Spool disk budget too small for a %zu byte batch.\n", needed);
+		return false;
+	}
+
+	if ( !_map(segment, true) )
+	{
+		return false;
+	}
+
+	segments.push_back(segment);
+	return true;
+}
+
+// deletes the oldest segment, whatever was not sent yet is lost
+void
+Influx_Spool::
+_remove_front()
+{
+	Segment &segment = segments.front();
+
+	uint64_t lost = 0;
+	for ( size_t pos = segment.read_pos; pos < segment.write_pos; )
+	{
+		uint8_t *record = segment.base + pos;
+		if ( *spool_field(record, SPOOL_MAGIC_OFF) == SPOOL_MAGIC )
+		{
+			lost += *spool_field(record, SPOOL_POINTS_OFF);
+		}
+		pos += spool_record_len(*spool_field(record, SPOOL_SIZE_OFF));
+	}
+
+	if ( lost )
+	{
+		printf("[WARNING] Spool over its disk budget. Dropping %llu points.\n", (unsigned long long)lost);
+		drop_count += lost;
+	}
+
+	munmap(segment.base, segment.size);
+	::close(segment.fd);
+	unlink(_path(segment.seq).c_str());
+
+	segments.pop_front();
+}
@@ -0,0 +1,114 @@
+#ifndef INFLUX_SPOOL_H_
+#define INFLUX_SPOOL_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "line_protocol.h"
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// position of a record, handed out by peek() and given back to consume()
+struct Spool_Position
+{
+	uint64_t segment;
+	size_t   offset;
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Influx Spool Class
+// ----------------------------------------------------------------------------------
+/*
+ * Influx Spool Class
+ *
+ * Write-ahead store for batches the database could not take. Batches are
+ * appended to memory mapped segment files in a directory, one after the
+ * other, so writing one costs a memcpy into the page cache. The disk space of
+ * a segment is allocated when it is created, so a full disk fails the append
+ * rather than the write into the mapping. A full segment is closed and a new
+ * one started; when the segments go over the disk budget the oldest one is
+ * deleted, its points are lost and counted.
+ *
+ * Records are read back oldest first with peek() and marked as sent in place
+ * with consume(), so the spool survives a restart and replays from where it
+ * stopped. Segments that are fully sent are deleted.
+ *
+ * Each record is a header followed by the line protocol body:
+ *
+ *     magic (4) | database (4) | points (4) | size (4) | body, padded to 8
+ *
+ * The magic is written last, a record cut by a crash is never read.
+ */
+class Influx_Spool
+{
+
+public:
+
+	Influx_Spool();
+	~Influx_Spool();
+
+	// set before open(), an empty directory leaves the spool disabled
+	std::string directory;
+	size_t segment_size;
+	uint64_t disk_budget;
+
+	void open();
+	void close();
+	bool enabled() const { return is_open; }
+
+	// false if the spool is disabled or the batch could not be stored
+	bool append(int db, const Line_Buffer &lines);
+
+	// copies the oldest record not yet sent into lines, false if there is none
+	bool peek(int &db, Line_Buffer &lines, Spool_Position &position);
+	void consume(const Spool_Position &position);
+
+	uint64_t spooled_points() const { return spooled_count; }
+	uint64_t dropped_points() const { return drop_count; }
+
+private:
+
+	struct Segment
+	{
+		uint64_t seq;
+		int      fd;
+		uint8_t *base;
+		size_t   size;
+		size_t   read_pos;
+		size_t   write_pos;
+		bool     writable;  // allocated by this run, old segments are only read
+	};
+
+	bool is_open;
+	std::deque<Segment> segments;
+	uint64_t next_seq;
+
+	std::atomic<uint64_t> spooled_count;
+	std::atomic<uint64_t> drop_count;
+
+	std::mutex mutex;
+
+	std::string _path(uint64_t seq);
+	bool _map(Segment &segment, bool create);
+	void _scan(Segment &segment);
+	void _skip_sent(Segment &segment);
+	bool _rotate(size_t needed);
+	void _remove_front();
+
+};
+
+
+
+#endif // INFLUX_SPOOL_H_
@@ -0,0 +1,263 @@
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "influx_udp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// datagrams per sendmmsg call
+#define UDP_BURST 64
+
+// how long a burst waits for a full socket buffer to drain before dropping
+#define UDP_DRAIN_MS 10
+
+// IP and UDP headers in front of the payload
+#define UDP_IPV4_OVERHEAD 28
+#define UDP_IPV6_OVERHEAD 48
+
+
+// ----------------------------------------------------------------------------------
+//   Influx UDP Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Influx_Udp::
+Influx_Udp()
+{
+	mtu         = 1500;
+	sndbuf_size = 0;
+
+	fd      = -1;
+	payload = 0;
+	failing = false;
+
+	sent_count     = 0;
+	datagram_count = 0;
+	drop_count     = 0;
+}
+
+Influx_Udp::
+~Influx_Udp()
+{
+	close();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Open / Close
+// ------------------------------------------------------------------------------
+void
+Influx_Udp::
+open(const std::string &host, int port)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	char service[16];
+	snprintf(service, sizeof(service), "%d", port);
+
+	struct addrinfo *result = NULL;
+	int rc = getaddrinfo(host.c_str(), service, &hints, &result);
+	if ( rc != 0 || result == NULL )
+	{
+		printf("[ERROR] Can't resolve InfluxDB UDP listener %s:%d: %s\n", host.c_str(), port,
+		       rc == EAI_SYSTEM ? strerror(errno) : gai_strerror(rc));
+		throw EXIT_FAILURE;
+	}
+
+	fd = socket(result->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if ( fd < 0 )
+	{
+		printf("[ERROR] Can't open UDP socket: %s\n", strerror(errno));
+		freeaddrinfo(result);
+		throw EXIT_FAILURE;
+	}
+
+	if ( sndbuf_size > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf_size, sizeof(sndbuf_size)) < 0 )
+	{
+		printf("[WARNING] Can't set UDP send buffer to %d bytes: %s\n", sndbuf_size, strerror(errno));
+	}
+
+	// connected, so sendmmsg needs no address and refusals get reported
+	if ( connect(fd, result->ai_addr, result->ai_addrlen) < 0 )
+	{
+		printf("[ERROR] Can't connect UDP socket to %s:%d: %s\n", host.c_str(), port, strerror(errno));
+		freeaddrinfo(result);
+		close();
+		throw EXIT_FAILURE;
+	}
+
+	int overhead = result->ai_family == AF_INET6 ? UDP_IPV6_OVERHEAD : UDP_IPV4_OVERHEAD;
+	payload = mtu > overhead ? mtu - overhead : 1;
+
+	freeaddrinfo(result);
+
+	printf("[INFO] Sending line protocol to UDP %s:%d, %zu bytes per datagram.\n", host.c_str(), port, payload);
+}
+
+void
+Influx_Udp::
+close()
+{
+	if ( fd >= 0 )
+	{
+		::close(fd);
+		fd = -1;
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Send
+// ------------------------------------------------------------------------------
+bool
+Influx_Udp::
+send(const Line_Buffer &lines)
+{
+	if ( fd < 0 )
+	{
+		drop_count += lines.points();
+		return false;
+	}
+
+	struct mmsghdr msgs[UDP_BURST];
+	struct iovec   iovs[UDP_BURST];
+	uint32_t       points[UDP_BURST];
+	int count = 0;
+	bool ok = true;
+
+	const char *data = lines.data();
+	size_t size = lines.size();
+	size_t pos  = 0;
+
+	while ( pos < size )
+	{
+		// whole lines while they fit, at least one
+		size_t start = pos;
+		uint32_t n   = 0;
+
+		while ( pos < size )
+		{
+			const char *newline = (const char *)memchr(data + pos, '\n', size - pos);
+			size_t next = newline ? newline - data + 1 : size;
+
+			if ( n > 0 && next - start > payload )
+			{
+				break;
+			}
+
+			pos = next;
+			n++;
+		}
+
+		iovs[count].iov_base = (void *)(data + start);
+		iovs[count].iov_len  = pos - start;
+
+		memset(&msgs[count].msg_hdr, 0, sizeof(msgs[count].msg_hdr));
+		msgs[count].msg_hdr.msg_iov    = &iovs[count];
+		msgs[count].msg_hdr.msg_iovlen = 1;
+		msgs[count].msg_len            = 0;
+		points[count] = n;
+
+		if ( ++count == UDP_BURST )
+		{
+			ok &= _send_burst(msgs, points, count);
+			count = 0;
+		}
+	}
+
+	if ( count > 0 )
+	{
+		ok &= _send_burst(msgs, points, count);
+	}
+
+	return ok;
+}
+
+bool
+Influx_Udp::
+_send_burst(struct mmsghdr *msgs, const uint32_t *points, int count)
+{
+	int done = 0;
+	bool ok  = true;
+	bool waited = false;
+
+	while ( done < count )
+	{
+		int sent = sendmmsg(fd, msgs + done, count - done, 0);
+
+		if ( sent > 0 )
+		{
+			for ( int i = done; i < done + sent; i++ )
+			{
+				sent_count += points[i];
+			}
+			datagram_count += sent;
+			done += sent;
+
+			if ( failing && failing.exchange(false) )
+			{
+				printf("[INFO] UDP listener reachable again.\n");
+			}
+			continue;
+		}
+
+		if ( sent < 0 && errno == EINTR )
+		{
+			continue;
+		}
+
+		int err = sent < 0 ? errno : EAGAIN;
+
+		// a batch can be more than the buffer holds, give the NIC a moment
+		if ( (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS) && !waited )
+		{
+			waited = true;
+
+			struct pollfd pfd;
+			pfd.fd      = fd;
+			pfd.events  = POLLOUT;
+			pfd.revents = 0;
+			if ( poll(&pfd, 1, UDP_DRAIN_MS) > 0 )
+			{
+				continue;
+			}
+		}
+
+		if ( !failing.exchange(true) )
+		{
+			printf("[WARNING] Dropping UDP datagrams: %s\n", strerror(err));
+		}
+		ok = false;
+
+		// a full socket buffer won't drain before the next call, drop the
+		// rest; anything else was reported for this datagram alone
+		int last = (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS) ? count : done + 1;
+		for ( int i = done; i < last; i++ )
+		{
+			drop_count += points[i];
+		}
+		done = last;
+	}
+
+	return ok;
+}
@@ -0,0 +1,80 @@
+#ifndef INFLUX_UDP_H_
+#define INFLUX_UDP_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <string>
+
+#include "line_protocol.h"
+
+
+// ----------------------------------------------------------------------------------
+//   Influx UDP Class
+// ----------------------------------------------------------------------------------
+/*
+ * Influx UDP Class
+ *
+ * Fire and forget output to the UDP listener of InfluxDB or the
+ * socket_listener of Telegraf. Whole lines of a batch are packed into
+ * datagrams of at most mtu bytes with their IP and UDP headers, a line too
+ * long for one datagram is sent on its own. The datagrams point straight into
+ * the batch and leave in bursts through sendmmsg, one system call for up to
+ * 64 of them, so batches are best many datagrams long.
+ *
+ * Nothing is acknowledged. A burst the socket buffer can't take waits briefly
+ * for it to drain once; datagrams it still can't take or the kernel reports
+ * as refused are dropped and counted, never retried. The listener writes
+ * everything to the one database it is configured with.
+ */
+class Influx_Udp
+{
+
+public:
+
+	Influx_Udp();
+	~Influx_Udp();
+
+	// set before open()
+	int mtu;
+	int sndbuf_size;
+
+	// throws EXIT_FAILURE if the address can't be used
+	void open(const std::string &host, int port);
+	void close();
+	bool enabled() const { return fd >= 0; }
+
+	// room for line protocol in one datagram
+	size_t payload_size() const { return payload; }
+
+	// sends the whole batch, false if some of it was dropped
+	bool send(const Line_Buffer &lines);
+
+	uint64_t sent_points()    const { return sent_count.load(); }
+	uint64_t sent_datagrams() const { return datagram_count.load(); }
+	uint64_t dropped_points() const { return drop_count.load(); }
+
+private:
+
+	int fd;
+	size_t payload;
+
+	// fleet workers share the socket, only one of them logs a change
+	std::atomic<bool> failing;
+
+	std::atomic<uint64_t> sent_count;
+	std::atomic<uint64_t> datagram_count;
+	std::atomic<uint64_t> drop_count;
+
+	bool _send_burst(struct mmsghdr *msgs, const uint32_t *points, int count);
+
+};
+
+
+
+#endif // INFLUX_UDP_H_
@@ -0,0 +1,739 @@
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "influx_writer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+
+static uint64_t
+thread_cpu_nsec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static uint64_t
+monotonic_usec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+#define GZIP_REPORT_USEC  60000000ULL
+#define SPOOL_REPORT_USEC 60000000ULL
+
+static const char *PLAIN_HEADERS = "Content-Type: text/plain; charset=utf-8\r\n";
+static const char *GZIP_HEADERS  = "Content-Type: text/plain; charset=utf-8\r\nContent-Encoding: gzip\r\n";
+static const char *QUERY_HEADERS = "Content-Type: application/x-www-form-urlencoded\r\n";
+
+// results of a single post
+#define POST_OK       0
+#define POST_RETRY    1
+#define POST_REJECTED 2
+
+
+// ----------------------------------------------------------------------------------
+//   Influx Writer Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Influx_Writer::
+Influx_Writer()
+{
+	threads         = 1;
+	overflow_policy = INFLUX_OVERFLOW_DROP_OLDEST;
+	max_queued      = 64;
+	max_retries     = 5;
+	backoff_ms      = 100;
+	max_backoff_ms  = 5000;
+	spool_rate      = 1000;
+	gzip_level      = 0;
+	gzip_min_bytes  = 1024;
+
+	stopping  = false;
+	replaying = false;
+	sink_down = false;
+
+	sent_count   = 0;
+	drop_count   = 0;
+	retry_count  = 0;
+	replay_count = 0;
+
+	gzip_batches     = 0;
+	gzip_in_bytes    = 0;
+	gzip_out_bytes   = 0;
+	gzip_cpu_ns      = 0;
+	gzip_report_usec = 0;
+}
+
+Influx_Writer::
+~Influx_Writer()
+{
+	stop();
+
+	for ( Influx_Batch *batch : queue )
+		delete batch;
+	for ( Influx_Batch *batch : spare )
+		delete batch;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Configuration
+// ------------------------------------------------------------------------------
+void
+Influx_Writer::
+set_server(const std::string &host, int port)
+{
+	http.set_server(host, port);
+}
+
+void
+Influx_Writer::
+set_database(int db, const std::string &name, const std::string &retention)
+{
+	if ( (size_t)db >= names.size() )
+	{
+		names.resize(db + 1);
+		paths.resize(db + 1);
+		create_queries.resize(db + 1);
+	}
+
+	names[db]          = name;
+	paths[db]          = "/write?db=" + name;
+	create_queries[db] = "q=CREATE DATABASE \"" + name + "\"";
+
+	if ( !retention.empty() )
+	{
+		// statements are separated by an url encoded ';'
+		paths[db]          += "&rp=" + retention;
+		create_queries[db] += "%3BCREATE RETENTION POLICY \"" + retention + "\" ON \"" + name + "\" DURATION INF REPLICATION 1";
+	}
+}
+
+bool
+Influx_Writer::
+create_database(int db)
+{
+	const char *error = NULL;
+	const std::string &query = create_queries[db];
+
+	int status = http.post("/query", QUERY_HEADERS, query.data(), query.size(), error);
+	if ( status < 0 )
+	{
+		printf("[WARNING] Can't create database %s: %s\n", names[db].c_str(), error);
+		return false;
+	}
+	if ( status < 200 || status >= 300 )
+	{
+		printf("[WARNING] Can't create database %s: HTTP %d\n", names[db].c_str(), status);
+		return false;
+	}
+
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Start / Stop
+// ------------------------------------------------------------------------------
+void
+Influx_Writer::
+start()
+{
+	gzip_report_usec = monotonic_usec();
+
+	stopping = false;
+
+	spool.open();
+
+	for ( int i = 0; i < std::max(threads, 1); i++ )
+	{
+		pthread_t tid;
+		int result = pthread_create( &tid, NULL, &start_influx_writer_thread, this );
+		if ( result ) throw result;
+
+		tids.push_back(tid);
+	}
+
+	if ( spool.enabled() )
+	{
+		int result = pthread_create( &replay_tid, NULL, &start_influx_replay_thread, this );
+		if ( result ) throw result;
+
+		replaying = true;
+	}
+}
+
+void
+Influx_Writer::
+stop()
+{
+	if ( tids.empty() )
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	not_empty.notify_all();
+	not_full.notify_all();
+	wake.notify_all();
+
+	// the threads drain the queue before they leave
+	for ( pthread_t tid : tids )
+	{
+		pthread_join(tid, NULL);
+	}
+	tids.clear();
+
+	// whatever is left in the spool waits for the next run
+	if ( replaying )
+	{
+		pthread_join(replay_tid, NULL);
+		replaying = false;
+	}
+	print_spool_stats();
+	spool.close();
+	http.close_all();
+
+	print_gzip_stats();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Submit
+// ------------------------------------------------------------------------------
+Influx_Batch *
+Influx_Writer::
+acquire(int db)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return _take_spare(db);
+}
+
+Influx_Batch *
+Influx_Writer::
+submit(Influx_Batch *batch)
+{
+	int db = batch->db;
+	size_t limit = std::max(max_queued, (size_t)1);
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while ( queue.size() >= limit && !stopping )
+	{
+		if ( overflow_policy == INFLUX_OVERFLOW_BLOCK )
+		{
+			not_full.wait(lock);
+		}
+		else if ( overflow_policy == INFLUX_OVERFLOW_DROP_NEWEST )
+		{
+			// the spool has its own lock, other callers don't wait for the disk
+			lock.unlock();
+
+			if ( !_spool(batch) )
+			{
+				printf("[WARNING] InfluxDB writer queue full. Dropping %zu points.\n", batch->lines.points());
+				drop_count += batch->lines.points();
+			}
+
+			// hand the same batch back, emptied
+			batch->lines.clear();
+			return batch;
+		}
+		else
+		{
+			Influx_Batch *oldest = queue.front();
+			queue.pop_front();
+
+			lock.unlock();
+
+			if ( !_spool(oldest) )
+			{
+				printf("[WARNING] InfluxDB writer queue full. Dropping %zu older points.\n", oldest->lines.points());
+				drop_count += oldest->lines.points();
+			}
+
+			lock.lock();
+			_recycle(oldest);
+		}
+	}
+
+	queue.push_back(batch);
+	not_empty.notify_one();
+
+	return _take_spare(db);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Writer Thread
+// ------------------------------------------------------------------------------
+void
+Influx_Writer::
+start_writer_thread()
+{
+	Writer_Context context;
+	_open_context(context);
+
+	while ( true )
+	{
+		Influx_Batch *batch;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			not_empty.wait(lock, [this] { return !queue.empty() || stopping; });
+
+			if ( queue.empty() )
+			{
+				break;
+			}
+
+			batch = queue.front();
+			queue.pop_front();
+		}
+		not_full.notify_one();
+
+		// no use trying while the database is down, the replay thread finds
+		// out when it is back
+		if ( !(sink_down && _spool(batch)) )
+		{
+			_send(context, batch);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			_recycle(batch);
+		}
+	}
+
+	_close_context(context);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Send With Retries
+// ------------------------------------------------------------------------------
+void
+Influx_Writer::
+_send(Writer_Context &context, Influx_Batch *batch)
+{
+	const char *name = names[batch->db].c_str();
+	size_t points  = batch->lines.points();
+	int delay_ms   = backoff_ms;
+
+	for ( int attempt = 0; ; attempt++ )
+	{
+		int status = 0;
+		int result = _post(context, batch->db, batch->lines, status);
+
+		if ( result == POST_OK )
+		{
+			sent_count += points;
+			return;
+		}
+
+		if ( result == POST_REJECTED )
+		{
+			printf("[ERROR] InfluxDB rejected a %s batch (HTTP %d). Dropping %zu points.\n", name, status, points);
+			drop_count += points;
+			return;
+		}
+
+		// no more waiting once asked to stop
+		std::unique_lock<std::mutex> lock(mutex);
+		if ( attempt >= max_retries || stopping )
+		{
+			lock.unlock();
+
+			if ( _spool(batch) )
+			{
+				_sink_state(true);
+				return;
+			}
+
+			printf("[ERROR] Can't push %s batch. Dropping %zu points.\n", name, points);
+			drop_count += points;
+			return;
+		}
+
+		wake.wait_for(lock, std::chrono::milliseconds(delay_ms), [this] { return stopping; });
+		delay_ms = std::min(delay_ms * 2, max_backoff_ms);
+		retry_count++;
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Replay Thread
+// ------------------------------------------------------------------------------
+void
+Influx_Writer::
+start_replay_thread()
+{
+	Writer_Context context;
+	_open_context(context);
+
+	Line_Buffer lines;
+	Spool_Position position;
+	int db;
+	int delay_ms = backoff_ms;
+	uint64_t report_usec = monotonic_usec();
+
+	while ( true )
+	{
+		int wait_ms;
+
+		if ( monotonic_usec() - report_usec >= SPOOL_REPORT_USEC )
+		{
+			print_spool_stats();
+			report_usec = monotonic_usec();
+		}
+
+		if ( !spool.peek(db, lines, position) )
+		{
+			// nothing left to find out with, the budget evicted it
+			if ( sink_down.exchange(false) )
+			{
+				printf("[WARNING] Spool emptied by its disk budget. Trying InfluxDB with new batches.\n");
+			}
+			wait_ms = 1000;
+		}
+		else if ( (size_t)db >= paths.size() || paths[db].empty() )
+		{
+			printf("[ERROR] Spooled batch for unknown database %d. Dropping %zu points.\n", db, lines.points());
+			drop_count += lines.points();
+			spool.consume(position);
+			wait_ms = 0;
+		}
+		else
+		{
+			int status = 0;
+			int result = _post(context, db, lines, status);
+
+			if ( result == POST_RETRY )
+			{
+				_sink_state(true);
+				wait_ms   = delay_ms;
+				delay_ms  = std::min(delay_ms * 2, max_backoff_ms);
+			}
+			else
+			{
+				if ( result == POST_OK )
+				{
+					// the database is back, new batches go to it again while
+					// the spool is backfilled behind them
+					_sink_state(false);
+					sent_count   += lines.points();
+					replay_count += lines.points();
+				}
+				else
+				{
+					printf("[ERROR] InfluxDB rejected a spooled %s batch (HTTP %d). Dropping %zu points.\n", names[db].c_str(), status, lines.points());
+					drop_count += lines.points();
+				}
+
+				spool.consume(position);
+				delay_ms = backoff_ms;
+				wait_ms  = spool_rate > 0 ? (int)(lines.points() * 1000 / spool_rate) : 0;
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		if ( stopping )
+		{
+			break;
+		}
+		if ( wait_ms > 0 )
+		{
+			wake.wait_for(lock, std::chrono::milliseconds(wait_ms), [this] { return stopping; });
+		}
+	}
+
+	_close_context(context);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Single Post
+// ------------------------------------------------------------------------------
+int
+Influx_Writer::
+_post(Writer_Context &context, int db, const Line_Buffer &lines, int &status)
+{
+	const char *error = NULL;
+
+	if ( _compress(context, lines) )
+	{
+		status = http.post(paths[db].c_str(), GZIP_HEADERS, context.gzip_body.data(), context.gzip_len, error);
+	}
+	else
+	{
+		// the body is posted straight from the arena
+		status = http.post(paths[db].c_str(), PLAIN_HEADERS, lines.data(), lines.size(), error);
+	}
+
+	if ( status < 0 )
+	{
+		printf("[WARNING] Post to %s failed: %s\n", names[db].c_str(), error);
+		return POST_RETRY;
+	}
+
+	if ( status >= 200 && status < 300 )
+	{
+		return POST_OK;
+	}
+
+	// the database could not be created at startup, do it now and try again
+	if ( status == 404 )
+	{
+		create_database(db);
+		return POST_RETRY;
+	}
+
+	if ( status == 429 || status >= 500 )
+	{
+		printf("[WARNING] Post to %s failed: HTTP %d\n", names[db].c_str(), status);
+		return POST_RETRY;
+	}
+
+	return POST_REJECTED;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Gzip Body
+// ------------------------------------------------------------------------------
+// false if the body goes out as it is
+bool
+Influx_Writer::
+_compress(Writer_Context &context, const Line_Buffer &lines)
+{
+	if ( gzip_level <= 0 || lines.size() < gzip_min_bytes )
+	{
+		return false;
+	}
+
+	uint64_t cpu_start = thread_cpu_nsec();
+
+	// one stream per thread, reset between batches
+	if ( !context.gzip_ready )
+	{
+		memset(&context.gzip, 0, sizeof(context.gzip));
+		if ( deflateInit2(&context.gzip, std::min(gzip_level, 9), Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK )
+		{
+			return false;
+		}
+		context.gzip_ready = true;
+	}
+	else
+	{
+		deflateReset(&context.gzip);
+	}
+
+	size_t bound = deflateBound(&context.gzip, lines.size());
+	if ( context.gzip_body.size() < bound )
+	{
+		context.gzip_body.resize(bound);
+	}
+
+	context.gzip.next_in   = (Bytef *)lines.data();
+	context.gzip.avail_in  = lines.size();
+	context.gzip.next_out  = context.gzip_body.data();
+	context.gzip.avail_out = bound;
+
+	if ( deflate(&context.gzip, Z_FINISH) != Z_STREAM_END )
+	{
+		return false;
+	}
+
+	context.gzip_len = context.gzip.total_out;
+
+	gzip_batches   += 1;
+	gzip_in_bytes  += lines.size();
+	gzip_out_bytes += context.gzip.total_out;
+	gzip_cpu_ns    += thread_cpu_nsec() - cpu_start;
+
+	uint64_t last = gzip_report_usec;
+	uint64_t now  = monotonic_usec();
+	if ( now - last >= GZIP_REPORT_USEC && gzip_report_usec.compare_exchange_strong(last, now) )
+	{
+		print_gzip_stats();
+	}
+
+	return true;
+}
+
+void
+Influx_Writer::
+print_gzip_stats()
+{
+	uint64_t batches = gzip_batches;
+	uint64_t in      = gzip_in_bytes;
+	uint64_t out     = gzip_out_bytes;
+	uint64_t cpu_ns  = gzip_cpu_ns;
+
+	if ( batches == 0 || out == 0 )
+	{
+		return;
+	}
+
+	printf("[INFO] gzip level %d: %llu batches, %.1f MB -> %.1f MB (ratio %.2f), %.1f ms CPU, %.2f ms per MB.\n",
+		gzip_level, (unsigned long long)batches, in / 1e6, out / 1e6, (double)in / out,
+		cpu_ns / 1e6, (cpu_ns / 1e6) / (in / 1e6));
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions - Thread Context
+// ------------------------------------------------------------------------------
+void
+Influx_Writer::
+_open_context(Writer_Context &context)
+{
+	context.gzip_ready = false;
+	context.gzip_len   = 0;
+}
+
+void
+Influx_Writer::
+_close_context(Writer_Context &context)
+{
+	if ( context.gzip_ready )
+	{
+		deflateEnd(&context.gzip);
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Spool
+// ------------------------------------------------------------------------------
+// false if there is no spool or it could not take the batch, spooled points
+// are counted by the spool and reported every minute
+bool
+Influx_Writer::
+_spool(Influx_Batch *batch)
+{
+	return spool.append(batch->db, batch->lines);
+}
+
+// only the changes are logged, not every batch spooled meanwhile
+void
+Influx_Writer::
+_sink_state(bool down)
+{
+	if ( sink_down.exchange(down) == down )
+	{
+		return;
+	}
+
+	if ( down )
+	{
+		printf("[WARNING] InfluxDB unreachable. Spooling new batches.\n");
+	}
+	else
+	{
+		printf("[INFO] InfluxDB reachable again. Sending new batches, replaying the spool.\n");
+	}
+}
+
+void
+Influx_Writer::
+print_spool_stats()
+{
+	uint64_t spooled  = spool.spooled_points();
+	uint64_t replayed = replay_count;
+	uint64_t lost     = spool.dropped_points();
+
+	if ( spooled == 0 && replayed == 0 )
+	{
+		return;
+	}
+
+	printf("[INFO] Spool: %llu points spooled, %llu replayed, %llu lost to the disk budget.\n",
+		(unsigned long long)spooled, (unsigned long long)replayed, (unsigned long long)lost);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions - Batch Pool
+// ------------------------------------------------------------------------------
+// both called with the mutex held
+Influx_Batch *
+Influx_Writer::
+_take_spare(int db)
+{
+	Influx_Batch *batch;
+
+	if ( spare.empty() )
+	{
+		batch = new Influx_Batch;
+	}
+	else
+	{
+		batch = spare.back();
+		spare.pop_back();
+	}
+
+	batch->db = db;
+	return batch;
+}
+
+void
+Influx_Writer::
+_recycle(Influx_Batch *batch)
+{
+	batch->lines.clear();
+	spare.push_back(batch);
+}
+
+
+// ------------------------------------------------------------------------------
+//  Pthread Starter Helper Functions
+// ------------------------------------------------------------------------------
+
+void*
+start_influx_writer_thread(void *args)
+{
+	// takes a writer object argument
+	Influx_Writer *writer = (Influx_Writer *)args;
+
+	// run the object's writer thread
+	writer->start_writer_thread();
+
+	// done!
+	return NULL;
+}
+
+void*
+start_influx_replay_thread(void *args)
+{
+	// takes a writer object argument
+	Influx_Writer *writer = (Influx_Writer *)args;
+
+	// run the object's replay thread
+	writer->start_replay_thread();
+
+	// done!
+	return NULL;
+}
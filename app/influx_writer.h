@@ -0,0 +1,199 @@
+#ifndef INFLUX_WRITER_H_
+#define INFLUX_WRITER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "line_protocol.h"
+#include "influx_spool.h"
+#include "http_client.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// what submit() does when the queue is full
+#define INFLUX_OVERFLOW_DROP_OLDEST 0
+#define INFLUX_OVERFLOW_DROP_NEWEST 1
+#define INFLUX_OVERFLOW_BLOCK       2
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// a serialized batch of points for one database
+struct Influx_Batch
+{
+	int db;
+	Line_Buffer lines;
+};
+
+// what each sending thread keeps to itself
+struct Writer_Context
+{
+	z_stream gzip;
+	bool gzip_ready;
+	std::vector<uint8_t> gzip_body;  // only grows
+	size_t gzip_len;
+};
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+void* start_influx_writer_thread(void *args);
+void* start_influx_replay_thread(void *args);
+
+
+// ----------------------------------------------------------------------------------
+//   Influx Writer Class
+// ----------------------------------------------------------------------------------
+/*
+ * Influx Writer Class
+ *
+ * Posts serialized batches to InfluxDB from background threads, so a slow or
+ * unreachable database never holds up the caller. All threads share the
+ * keep-alive connections of one Http_Client. Batches wait in a bounded
+ * queue; when it is full the overflow policy decides between dropping the
+ * oldest queued batch, dropping the new one or blocking the caller.
+ *
+ * Failed posts (connection errors, 429 and 5xx answers) are retried with an
+ * exponential backoff, other 4xx answers are dropped right away since sending
+ * the same body again won't help. A missing database is created on the fly.
+ * On stop() whatever is queued still gets one attempt before the threads exit.
+ *
+ * With a spool directory set, batches that can't be sent or don't fit in the
+ * queue go to the disk spool instead of being dropped. Once a batch has
+ * failed all its retries the database is considered down and new batches go
+ * straight to the spool. A replay thread keeps trying the oldest spooled
+ * batch; once one gets through new batches are sent live again and the spool
+ * is backfilled behind them at spool_rate points per second, so points may
+ * arrive out of order but the spool can't grow while the database is up.
+ * Only the database going down and coming back are logged, the spooled and
+ * replayed points are reported every minute and on stop().
+ *
+ * Bodies of at least gzip_min_bytes are sent gzip compressed when gzip_level
+ * is set. The compression ratio and the CPU time it costs are reported every
+ * minute and on stop().
+ *
+ * Batches are recycled, in steady state submit() doesn't allocate.
+ */
+class Influx_Writer
+{
+
+public:
+
+	Influx_Writer();
+	~Influx_Writer();
+
+	// set before start()
+	int threads;
+	int overflow_policy;
+	size_t max_queued;
+	int max_retries;
+	int backoff_ms;
+	int max_backoff_ms;
+
+	// points per second replayed from the spool, 0 for as fast as possible
+	int spool_rate;
+	Influx_Spool spool;
+
+	// 1 (fast) to 9 (small), 0 sends plain text
+	int gzip_level;
+	size_t gzip_min_bytes;
+
+	// timeouts and pool size can be set before start()
+	Http_Client http;
+
+	void set_server(const std::string &host, int port);
+	// points go to the retention policy if one is given, it is created with the database
+	void set_database(int db, const std::string &name, const std::string &retention = "");
+
+	// blocking, false if the server could not be reached
+	bool create_database(int db);
+
+	void start();
+	void stop();
+
+	// empty batch to fill for db
+	Influx_Batch *acquire(int db);
+
+	// queues a filled batch, returns an empty one for the same database
+	Influx_Batch *submit(Influx_Batch *batch);
+
+	uint64_t sent_points()    const { return sent_count.load(); }
+	uint64_t dropped_points() const { return drop_count.load(); }
+	uint64_t retries()        const { return retry_count.load(); }
+
+	void print_gzip_stats();
+	void print_spool_stats();
+
+	void start_writer_thread();
+	void start_replay_thread();
+
+private:
+
+	std::vector<std::string> names;
+	std::vector<std::string> paths;
+	std::vector<std::string> create_queries;
+
+	std::vector<pthread_t> tids;
+	pthread_t replay_tid;
+	bool replaying;
+
+	// set once a batch failed all its retries, cleared by the first replayed
+	// batch that gets through
+	std::atomic<bool> sink_down;
+
+	std::deque<Influx_Batch *> queue;
+	std::vector<Influx_Batch *> spare;
+
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::condition_variable wake;
+	bool stopping;
+
+	std::atomic<uint64_t> sent_count;
+	std::atomic<uint64_t> drop_count;
+	std::atomic<uint64_t> retry_count;
+	std::atomic<uint64_t> replay_count;
+
+	std::atomic<uint64_t> gzip_batches;
+	std::atomic<uint64_t> gzip_in_bytes;
+	std::atomic<uint64_t> gzip_out_bytes;
+	std::atomic<uint64_t> gzip_cpu_ns;
+	std::atomic<uint64_t> gzip_report_usec;
+
+	Influx_Batch *_take_spare(int db);
+	void _recycle(Influx_Batch *batch);
+
+	void _open_context(Writer_Context &context);
+	void _close_context(Writer_Context &context);
+	bool _compress(Writer_Context &context, const Line_Buffer &lines);
+
+	int  _post(Writer_Context &context, int db, const Line_Buffer &lines, int &status);
+	void _send(Writer_Context &context, Influx_Batch *batch);
+	bool _spool(Influx_Batch *batch);
+	void _sink_state(bool down);
+
+};
+
+
+
+#endif // INFLUX_WRITER_H_
@@ -7,135 +7,637 @@
 
 #include "influxdb_interface.h"
 
-InfluxDB_Interface::InfluxDB_Interface(std::string server_addr, int port)
+#include <time.h>
+#include <string.h>
+
+// generated by make from the MAVLink XML, the exporter falls back to the
+// field descriptors of the MAVLink headers without it
+#if __has_include("mavlink_line_encoders.h")
+#include "mavlink_line_encoders.h"
+#define HAVE_LINE_ENCODERS
+#endif
+
+// ------------------------------------------------------------------------------
+//   Line protocol names, escaped once at startup
+// ------------------------------------------------------------------------------
+
+// one point per message
+static const Line_Key MEAS_HIGHRES_IMU("highres_imu", true);
+static const Line_Key MEAS_ALTITUDE("altitude", true);
+static const Line_Key MEAS_ATTITUDE("attitude", true);
+static const Line_Key MEAS_BATTERY_STATUS("battery_status", true);
+static const Line_Key MEAS_ODOMETRY("odometry", true);
+static const Line_Key MEAS_VIBRATION("vibration", true);
+static const Line_Key MEAS_GPS_RAW_INT("gps_raw_int", true);
+static const Line_Key MEAS_LINK_TIMING("link_timing", true);
+
+static const Line_Key KEY_SYSID("sysid");
+static const Line_Key KEY_COMPID("compid");
+
+// legacy layout, the field names are also the measurement names
+static const Line_Key KEY_CATEGORY("category");
+static const Line_Key KEY_VALUE("value");
+static const Line_Key KEY_POSITION("position");
+
+static const Line_Key CATEGORY_IMU("imu");
+static const Line_Key CATEGORY_ALTITUDES("altitudes");
+static const Line_Key CATEGORY_ATTITUDE("attitude");
+static const Line_Key CATEGORY_BATTERY("battery");
+static const Line_Key CATEGORY_ESTIMATOR("estimator");
+
+static const Line_Key KEY_TEMPERATURE("temperature");
+static const Line_Key KEY_XACC("xacc");
+static const Line_Key KEY_YACC("yacc");
+static const Line_Key KEY_ZACC("zacc");
+static const Line_Key KEY_XGYRO("xgyro");
+static const Line_Key KEY_YGYRO("ygyro");
+static const Line_Key KEY_ZGYRO("zgyro");
+static const Line_Key KEY_XMAG("xmag");
+static const Line_Key KEY_YMAG("ymag");
+static const Line_Key KEY_ZMAG("zmag");
+static const Line_Key KEY_ABS_PRESSURE("abs_pressure");
+static const Line_Key KEY_ALTITUDE_LOCAL("altitude_local");
+static const Line_Key KEY_ALTITUDE_RELATIVE("altitude_relative");
+static const Line_Key KEY_ALTITUDE_TERRAIN("altitude_terrain");
+static const Line_Key KEY_BOTTOM_CLEARANCE("bottom_clearance");
+static const Line_Key KEY_ROLL("roll");
+static const Line_Key KEY_PITCH("pitch");
+static const Line_Key KEY_YAW("yaw");
+static const Line_Key KEY_ROLLSPEED("rollspeed");
+static const Line_Key KEY_PITCHSPEED("pitchspeed");
+static const Line_Key KEY_YAWSPEED("yawspeed");
+static const Line_Key KEY_CHARGE_STATE("charge_state");
+static const Line_Key KEY_CURRENT_BATTERY("current_battery");
+static const Line_Key KEY_X("x");
+static const Line_Key KEY_Y("y");
+static const Line_Key KEY_Z("z");
+static const Line_Key KEY_VX("vx");
+static const Line_Key KEY_VY("vy");
+static const Line_Key KEY_VZ("vz");
+static const Line_Key KEY_VIBRATION_X("vibration_x");
+static const Line_Key KEY_VIBRATION_Y("vibration_y");
+static const Line_Key KEY_VIBRATION_Z("vibration_z");
+static const Line_Key KEY_CLIPPING_0("clipping_0");
+static const Line_Key KEY_CLIPPING_1("clipping_1");
+static const Line_Key KEY_CLIPPING_2("clipping_2");
+static const Line_Key KEY_LATITUDE("latitude");
+static const Line_Key KEY_LONGITUDE("longitude");
+static const Line_Key KEY_ALTITUDE("altitude");
+static const Line_Key KEY_SATELLITES_VISIBLE("satellites_visible");
+static const Line_Key KEY_RTT_US("rtt_us");
+static const Line_Key KEY_LATENCY_US("latency_us");
+static const Line_Key KEY_CLOCK_OFFSET_US("clock_offset_us");
+
+// TIMESYNC replies slower than this answer somebody else's request
+static const int64_t TIMESYNC_MAX_RTT_NS = 10000000000LL;
+
+// wall clock time in nanoseconds of a time of the monotonic clock
+static uint64_t wall_nsec(uint64_t monotonic_usec)
+{
+    struct timespec real, mono;
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+
+    int64_t offset = ((int64_t)real.tv_sec - mono.tv_sec) * 1000000000LL + (real.tv_nsec - mono.tv_nsec);
+    return monotonic_usec * 1000 + offset;
+}
+
+InfluxDB_Interface::InfluxDB_Interface(std::string server_addr, int port) :
+    clocks(256)
 {
     this->port = port;
     this->server_addr = server_addr;
+
+    this->batch_size = 5000;
+    this->flush_interval_ms = 100;
+
+    this->schema = INFLUX_SCHEMA_LEGACY;
+    this->telemetry_db = this->databases[INFLUX_TELEMETRY_DB];
+
+    this->output = INFLUX_OUTPUT_HTTP;
+    this->udp_port = 8089;
+    this->sinks = this;
+
+    this->vehicle_time = true;
+    this->link_timing = false;
+
+    for (int i = 0; i < INFLUX_DB_COUNT; i++)
+    {
+        this->batch_start[i] = 0;
+        this->batch[i] = this->writer.acquire(i);
+        this->connected[i] = false;
+    }
 }
 
 InfluxDB_Interface::~InfluxDB_Interface()
 {
-    ;
+    flushAll();
+    this->writer.stop();
+
+    if (this->decimator.enabled())
+    {
+        printf("[INFO] Decimation: %llu field samples in, %llu written.\n",
+               (unsigned long long)this->decimator.samples_in(), (unsigned long long)this->decimator.samples_out());
+    }
+
+    if (this->udp.enabled())
+    {
+        printf("[INFO] UDP output: %llu points in %llu datagrams, %llu dropped.\n",
+               (unsigned long long)this->udp.sent_points(), (unsigned long long)this->udp.sent_datagrams(),
+               (unsigned long long)this->udp.dropped_points());
+    }
+
+    for (int i = 0; i < INFLUX_DB_COUNT; i++)
+    {
+        delete this->batch[i];
+    }
 }
 
 void InfluxDB_Interface::init() 
 {
-    try
+    if (this->output == INFLUX_OUTPUT_UDP)
+    {
+        // the listener picks the database, there is nothing to create
+        this->udp.open(this->server_addr, this->udp_port);
+
+        // one database, the tiers can only be told apart by their name
+        this->rollup.retention_policies = false;
+
+        for (int i = 0; i < INFLUX_DB_COUNT; i++)
+        {
+            this->connected[i] = true;
+        }
+        return;
+    }
+
+    for (int tier = 0; tier < ROLLUP_TIERS; tier++)
+    {
+        this->databases[INFLUX_ROLLUP_DB + tier] = this->telemetry_db;
+    }
+
+    this->writer.set_server(this->server_addr, this->port);
+
+    if (this->schema == INFLUX_SCHEMA_MESSAGE || this->exporter.enabled() || this->link_timing)
+    {
+        this->databases[INFLUX_TELEMETRY_DB] = this->telemetry_db;
+        this->connect(INFLUX_TELEMETRY_DB);
+    }
+    if (this->schema == INFLUX_SCHEMA_LEGACY)
     {
         for (int i = 0; i < 6; i++)
         {
-            this->influx[i] = influxdb::InfluxDBFactory::Get("http://" + this->server_addr + ":" + std::to_string(port) + "?db=" + this->databases[i]);
-            this->influx[i]->createDatabaseIfNotExists();
+            this->connect(i);
         }
     }
-    catch(const std::exception& e)
+
+    if (this->rollup.enabled)
     {
-        printf("[ERROR] Unable to initialise InfluxDB connexion ...\n");
+        for (int tier = 0; tier < ROLLUP_TIERS; tier++)
+        {
+            this->connect(INFLUX_ROLLUP_DB + tier);
+        }
     }
 
+    this->writer.start();
+
     return;
     
 }
 
-void InfluxDB_Interface::pushData(Mavlink_Messages messages)
+void InfluxDB_Interface::attach(InfluxDB_Interface &shared)
+{
+    this->sinks = &shared;
+
+    this->batch_size = shared.batch_size;
+    this->flush_interval_ms = shared.flush_interval_ms;
+    this->schema = shared.schema;
+    this->telemetry_db = shared.telemetry_db;
+    this->output = shared.output;
+    this->vehicle_time = shared.vehicle_time;
+    this->link_timing = shared.link_timing;
+
+    for (int i = 0; i < INFLUX_DB_COUNT; i++)
+    {
+        this->databases[i] = shared.databases[i];
+        this->connected[i] = shared.connected[i];
+    }
+
+    this->decimator.copy_rules(shared.decimator);
+    this->exporter.copy_rules(shared.exporter);
+    this->rollup.enabled = shared.rollup.enabled;
+    this->rollup.retention_policies = shared.rollup.retention_policies;
+}
+
+void InfluxDB_Interface::connect(int db)
+{
+    // batches are kept even if the server is down now, the writer creates
+    // the database later if needed
+    if (db >= INFLUX_ROLLUP_DB && this->rollup.retention_policies)
+    {
+        this->writer.set_database(db, this->databases[db], Rollup::tier_policy(db - INFLUX_ROLLUP_DB));
+    }
+    else
+    {
+        this->writer.set_database(db, this->databases[db]);
+    }
+    this->connected[db] = true;
+
+    if (!this->writer.create_database(db))
+    {
+        printf("[ERROR] Unable to initialise InfluxDB connexion ...\n");
+    }
+}
+
+void InfluxDB_Interface::subscribe(Autopilot_Interface &autopilot_interface, int sinks)
+{
+    static const uint32_t written[] = {
+        MAVLINK_MSG_ID_HIGHRES_IMU,
+        MAVLINK_MSG_ID_ALTITUDE,
+        MAVLINK_MSG_ID_ATTITUDE,
+        MAVLINK_MSG_ID_BATTERY_STATUS,
+        MAVLINK_MSG_ID_ODOMETRY,
+        MAVLINK_MSG_ID_VIBRATION,
+        MAVLINK_MSG_ID_GPS_RAW_INT
+    };
+
+    for (uint32_t msgid : written)
+    {
+        autopilot_interface.subscribe(msgid, sinks);
+    }
+
+    if (this->link_timing)
+    {
+        autopilot_interface.subscribe(MAVLINK_MSG_ID_TIMESYNC, MESSAGE_SINK_QUEUE);
+    }
+
+    // the exporter works on the raw message, it only needs the events
+    if (this->exporter.exports_all())
+    {
+        autopilot_interface.subscribe_all(MESSAGE_SINK_QUEUE);
+    }
+    else
+    {
+        for (uint32_t msgid : this->exporter.allowed_ids())
+        {
+            autopilot_interface.subscribe(msgid, MESSAGE_SINK_QUEUE);
+        }
+    }
+}
+
+void InfluxDB_Interface::pushData(Autopilot_Interface &autopilot_interface)
+{
+    // every component on the link, each from one consistent snapshot
+    Mavlink_Messages messages;
+    size_t count = autopilot_interface.vehicle_count();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        autopilot_interface.get_messages(i, messages);
+
+        pushImu(messages.highres_imu, messages.sysid, messages.compid, messages.time_stamps.highres_imu);
+        pushAltitude(messages.altitude, messages.sysid, messages.compid, messages.time_stamps.altitude);
+        pushAttitude(messages.attitude, messages.sysid, messages.compid, messages.time_stamps.attitude);
+        pushBattery(messages.battery_status, messages.sysid, messages.compid, messages.time_stamps.battery_status);
+        pushOdometry(messages.odometry, messages.sysid, messages.compid, messages.time_stamps.odometry);
+        pushVibration(messages.vibration, messages.sysid, messages.compid, messages.time_stamps.vibration);
+        pushGps(messages.gps_raw, messages.sysid, messages.compid, messages.time_stamps.gps_raw);
+    }
+
+    return;
+}
+
+void InfluxDB_Interface::pushMessage(const Mavlink_Event &event)
 {
+    // one write per received message, nothing sampled twice
+    switch (event.message.msgid)
+    {
+        case MAVLINK_MSG_ID_HIGHRES_IMU:
+        {
+            mavlink_highres_imu_t highres_imu;
+            mavlink_msg_highres_imu_decode(&event.message, &highres_imu);
+            pushImu(highres_imu, event.message.sysid, event.message.compid, event.time_usec);
+            break;
+        }
+
+        case MAVLINK_MSG_ID_ALTITUDE:
+        {
+            mavlink_altitude_t altitude;
+            mavlink_msg_altitude_decode(&event.message, &altitude);
+            pushAltitude(altitude, event.message.sysid, event.message.compid, event.time_usec);
+            break;
+        }
+
+        case MAVLINK_MSG_ID_ATTITUDE:
+        {
+            mavlink_attitude_t attitude;
+            mavlink_msg_attitude_decode(&event.message, &attitude);
+            pushAttitude(attitude, event.message.sysid, event.message.compid, event.time_usec);
+            break;
+        }
+
+        case MAVLINK_MSG_ID_BATTERY_STATUS:
+        {
+            mavlink_battery_status_t battery_status;
+            mavlink_msg_battery_status_decode(&event.message, &battery_status);
+            pushBattery(battery_status, event.message.sysid, event.message.compid, event.time_usec);
+            break;
+        }
+
+        case MAVLINK_MSG_ID_ODOMETRY:
+        {
+            mavlink_odometry_t odometry;
+            mavlink_msg_odometry_decode(&event.message, &odometry);
+            pushOdometry(odometry, event.message.sysid, event.message.compid, event.time_usec);
+            break;
+        }
+
+        case MAVLINK_MSG_ID_VIBRATION:
+        {
+            mavlink_vibration_t vibration;
+            mavlink_msg_vibration_decode(&event.message, &vibration);
+            pushVibration(vibration, event.message.sysid, event.message.compid, event.time_usec);
+            break;
+        }
+
+        case MAVLINK_MSG_ID_GPS_RAW_INT:
+        {
+            mavlink_gps_raw_int_t gps_raw;
+            mavlink_msg_gps_raw_int_decode(&event.message, &gps_raw);
+            pushGps(gps_raw, event.message.sysid, event.message.compid, event.time_usec);
+            break;
+        }
+
+        case MAVLINK_MSG_ID_TIMESYNC:
+        {
+            if (!this->link_timing)
+            {
+                break;
+            }
+
+            mavlink_timesync_t timesync;
+            mavlink_msg_timesync_decode(&event.message, &timesync);
+            pushTimesync(timesync, event.message.sysid, event.message.compid, event.time_usec);
+            break;
+        }
+
+        default:
+        {
+            if (!this->exporter.enabled())
+            {
+                break;
+            }
+
+            const Export_Message *message = this->exporter.find(event.message.msgid);
+            if (message != NULL)
+            {
+                pushExport(event, *message);
+            }
+            break;
+        }
+    }
+
+    return;
+}
+
+void InfluxDB_Interface::pushImu(const mavlink_highres_imu_t &highres_imu, int sysid, int compid, uint64_t rx_usec)
+{
+    uint64_t timestamp = pointTime(sysid, compid, rx_usec, highres_imu.time_usec);
+    this->beginFields(MEAS_HIGHRES_IMU, sysid, compid, timestamp);
 
     try
     {
-        this->influx[INFLUX_IMU_DB]->write(influxdb::Point{"temperature"}.addTag("category", "imu").addField("value", messages.highres_imu.temperature));
-        this->influx[INFLUX_IMU_DB]->write(influxdb::Point{"xacc"}.addTag("category", "imu").addField("value", messages.highres_imu.xacc));
-        this->influx[INFLUX_IMU_DB]->write(influxdb::Point{"yacc"}.addTag("category", "imu").addField("value", messages.highres_imu.yacc));
-        this->influx[INFLUX_IMU_DB]->write(influxdb::Point{"zacc"}.addTag("category", "imu").addField("value", messages.highres_imu.zacc));
-        this->influx[INFLUX_IMU_DB]->write(influxdb::Point{"xgyro"}.addTag("category", "imu").addField("value", messages.highres_imu.xgyro));
-        this->influx[INFLUX_IMU_DB]->write(influxdb::Point{"ygyro"}.addTag("category", "imu").addField("value", messages.highres_imu.ygyro));
-        this->influx[INFLUX_IMU_DB]->write(influxdb::Point{"zgyro"}.addTag("category", "imu").addField("value", messages.highres_imu.zgyro));
-        this->influx[INFLUX_IMU_DB]->write(influxdb::Point{"xmag"}.addTag("category", "imu").addField("value", messages.highres_imu.xmag));
-        this->influx[INFLUX_IMU_DB]->write(influxdb::Point{"ymag"}.addTag("category", "imu").addField("value", messages.highres_imu.ymag));
-        this->influx[INFLUX_IMU_DB]->write(influxdb::Point{"zmag"}.addTag("category", "imu").addField("value", messages.highres_imu.zmag));
-        this->influx[INFLUX_IMU_DB]->write(influxdb::Point{"abs_pressure"}.addTag("category", "imu").addField("value", messages.highres_imu.abs_pressure));
+        if (this->schema == INFLUX_SCHEMA_MESSAGE)
+        {
+            Line_Buffer &point = this->beginMessage(MEAS_HIGHRES_IMU, sysid, compid);
+            this->writeField(point, KEY_TEMPERATURE, highres_imu.temperature);
+            this->writeField(point, KEY_XACC, highres_imu.xacc);
+            this->writeField(point, KEY_YACC, highres_imu.yacc);
+            this->writeField(point, KEY_ZACC, highres_imu.zacc);
+            this->writeField(point, KEY_XGYRO, highres_imu.xgyro);
+            this->writeField(point, KEY_YGYRO, highres_imu.ygyro);
+            this->writeField(point, KEY_ZGYRO, highres_imu.zgyro);
+            this->writeField(point, KEY_XMAG, highres_imu.xmag);
+            this->writeField(point, KEY_YMAG, highres_imu.ymag);
+            this->writeField(point, KEY_ZMAG, highres_imu.zmag);
+            this->writeField(point, KEY_ABS_PRESSURE, highres_imu.abs_pressure);
+            this->commit(INFLUX_TELEMETRY_DB, timestamp);
+            return;
+        }
+
+        this->writeValue(INFLUX_IMU_DB, KEY_TEMPERATURE, CATEGORY_IMU, highres_imu.temperature, timestamp);
+        this->writeValue(INFLUX_IMU_DB, KEY_XACC, CATEGORY_IMU, highres_imu.xacc, timestamp);
+        this->writeValue(INFLUX_IMU_DB, KEY_YACC, CATEGORY_IMU, highres_imu.yacc, timestamp);
+        this->writeValue(INFLUX_IMU_DB, KEY_ZACC, CATEGORY_IMU, highres_imu.zacc, timestamp);
+        this->writeValue(INFLUX_IMU_DB, KEY_XGYRO, CATEGORY_IMU, highres_imu.xgyro, timestamp);
+        this->writeValue(INFLUX_IMU_DB, KEY_YGYRO, CATEGORY_IMU, highres_imu.ygyro, timestamp);
+        this->writeValue(INFLUX_IMU_DB, KEY_ZGYRO, CATEGORY_IMU, highres_imu.zgyro, timestamp);
+        this->writeValue(INFLUX_IMU_DB, KEY_XMAG, CATEGORY_IMU, highres_imu.xmag, timestamp);
+        this->writeValue(INFLUX_IMU_DB, KEY_YMAG, CATEGORY_IMU, highres_imu.ymag, timestamp);
+        this->writeValue(INFLUX_IMU_DB, KEY_ZMAG, CATEGORY_IMU, highres_imu.zmag, timestamp);
+        this->writeValue(INFLUX_IMU_DB, KEY_ABS_PRESSURE, CATEGORY_IMU, highres_imu.abs_pressure, timestamp);
     }
     catch(const std::exception& e)
     {
         printf("[ERROR] Can't push imu data. Dropping record.\n");
     }
+}
+
+void InfluxDB_Interface::pushAltitude(const mavlink_altitude_t &altitude, int sysid, int compid, uint64_t rx_usec)
+{
+    uint64_t timestamp = pointTime(sysid, compid, rx_usec, altitude.time_usec);
+    this->beginFields(MEAS_ALTITUDE, sysid, compid, timestamp);
+
     try
     {
-        this->influx[INFLUX_ALTITUDE_DB]->write(influxdb::Point{"altitude_local"}.addTag("category", "altitudes").addField("value", messages.altitude.altitude_local));
-        this->influx[INFLUX_ALTITUDE_DB]->write(influxdb::Point{"altitude_relative"}.addTag("category", "altitudes").addField("value", messages.altitude.altitude_relative));
-        this->influx[INFLUX_ALTITUDE_DB]->write(influxdb::Point{"altitude_terrain"}.addTag("category", "altitudes").addField("value", messages.altitude.altitude_terrain));
-        this->influx[INFLUX_ALTITUDE_DB]->write(influxdb::Point{"bottom_clearance"}.addTag("category", "altitudes").addField("value", messages.altitude.bottom_clearance));
+        if (this->schema == INFLUX_SCHEMA_MESSAGE)
+        {
+            Line_Buffer &point = this->beginMessage(MEAS_ALTITUDE, sysid, compid);
+            this->writeField(point, KEY_ALTITUDE_LOCAL, altitude.altitude_local);
+            this->writeField(point, KEY_ALTITUDE_RELATIVE, altitude.altitude_relative);
+            this->writeField(point, KEY_ALTITUDE_TERRAIN, altitude.altitude_terrain);
+            this->writeField(point, KEY_BOTTOM_CLEARANCE, altitude.bottom_clearance);
+            this->commit(INFLUX_TELEMETRY_DB, timestamp);
+            return;
+        }
+
+        this->writeValue(INFLUX_ALTITUDE_DB, KEY_ALTITUDE_LOCAL, CATEGORY_ALTITUDES, altitude.altitude_local, timestamp);
+        this->writeValue(INFLUX_ALTITUDE_DB, KEY_ALTITUDE_RELATIVE, CATEGORY_ALTITUDES, altitude.altitude_relative, timestamp);
+        this->writeValue(INFLUX_ALTITUDE_DB, KEY_ALTITUDE_TERRAIN, CATEGORY_ALTITUDES, altitude.altitude_terrain, timestamp);
+        this->writeValue(INFLUX_ALTITUDE_DB, KEY_BOTTOM_CLEARANCE, CATEGORY_ALTITUDES, altitude.bottom_clearance, timestamp);
     }
     catch(const std::exception& e)
     {
         printf("[ERROR] Can't push altitude data. Dropping record.\n");
     }
+}
+
+void InfluxDB_Interface::pushAttitude(const mavlink_attitude_t &attitude, int sysid, int compid, uint64_t rx_usec)
+{
+    uint64_t timestamp = pointTime(sysid, compid, rx_usec, attitude.time_boot_ms * 1000ULL);
+    this->beginFields(MEAS_ATTITUDE, sysid, compid, timestamp);
+
     try
     {
-        this->influx[INFLUX_ATTITUDE_DB]->write(influxdb::Point{"roll"}.addTag("category", "attitude").addField("value", messages.attitude.roll));
-        this->influx[INFLUX_ATTITUDE_DB]->write(influxdb::Point{"pitch"}.addTag("category", "attitude").addField("value", messages.attitude.pitch));
-        this->influx[INFLUX_ATTITUDE_DB]->write(influxdb::Point{"yaw"}.addTag("category", "attitude").addField("value", messages.attitude.yaw));
-        this->influx[INFLUX_ATTITUDE_DB]->write(influxdb::Point{"rollspeed"}.addTag("category", "attitude").addField("value", messages.attitude.rollspeed));
-        this->influx[INFLUX_ATTITUDE_DB]->write(influxdb::Point{"pitchspeed"}.addTag("category", "attitude").addField("value", messages.attitude.pitchspeed));
-        this->influx[INFLUX_ATTITUDE_DB]->write(influxdb::Point{"yawspeed"}.addTag("category", "attitude").addField("value", messages.attitude.yawspeed));
+        if (this->schema == INFLUX_SCHEMA_MESSAGE)
+        {
+            Line_Buffer &point = this->beginMessage(MEAS_ATTITUDE, sysid, compid);
+            this->writeField(point, KEY_ROLL, attitude.roll);
+            this->writeField(point, KEY_PITCH, attitude.pitch);
+            this->writeField(point, KEY_YAW, attitude.yaw);
+            this->writeField(point, KEY_ROLLSPEED, attitude.rollspeed);
+            this->writeField(point, KEY_PITCHSPEED, attitude.pitchspeed);
+            this->writeField(point, KEY_YAWSPEED, attitude.yawspeed);
+            this->commit(INFLUX_TELEMETRY_DB, timestamp);
+            return;
+        }
+
+        this->writeValue(INFLUX_ATTITUDE_DB, KEY_ROLL, CATEGORY_ATTITUDE, attitude.roll, timestamp);
+        this->writeValue(INFLUX_ATTITUDE_DB, KEY_PITCH, CATEGORY_ATTITUDE, attitude.pitch, timestamp);
+        this->writeValue(INFLUX_ATTITUDE_DB, KEY_YAW, CATEGORY_ATTITUDE, attitude.yaw, timestamp);
+        this->writeValue(INFLUX_ATTITUDE_DB, KEY_ROLLSPEED, CATEGORY_ATTITUDE, attitude.rollspeed, timestamp);
+        this->writeValue(INFLUX_ATTITUDE_DB, KEY_PITCHSPEED, CATEGORY_ATTITUDE, attitude.pitchspeed, timestamp);
+        this->writeValue(INFLUX_ATTITUDE_DB, KEY_YAWSPEED, CATEGORY_ATTITUDE, attitude.yawspeed, timestamp);
     }
     catch(const std::exception& e)
     {
         printf("[ERROR] Can't push attitude data. Dropping record.\n");
     }
+}
+
+void InfluxDB_Interface::pushBattery(const mavlink_battery_status_t &battery_status, int sysid, int compid, uint64_t rx_usec)
+{
+    uint64_t timestamp = pointTime(sysid, compid, rx_usec, 0);
+    this->beginFields(MEAS_BATTERY_STATUS, sysid, compid, timestamp);
+
     try
     {
-        this->influx[INFLUX_BATTERY_DB]->write(influxdb::Point{"temperature"}.addTag("category", "battery").addField("value", (double)messages.battery_status.temperature));
-        this->influx[INFLUX_BATTERY_DB]->write(influxdb::Point{"charge_state"}.addTag("category", "battery").addField("value", (double)messages.battery_status.charge_state));
-        this->influx[INFLUX_BATTERY_DB]->write(influxdb::Point{"current_battery"}.addTag("category", "battery").addField("value", (double)messages.battery_status.current_battery));
+        if (this->schema == INFLUX_SCHEMA_MESSAGE)
+        {
+            Line_Buffer &point = this->beginMessage(MEAS_BATTERY_STATUS, sysid, compid);
+            this->writeFieldInt(point, KEY_TEMPERATURE, battery_status.temperature);
+            this->writeFieldInt(point, KEY_CHARGE_STATE, battery_status.charge_state);
+            this->writeFieldInt(point, KEY_CURRENT_BATTERY, battery_status.current_battery);
+            this->commit(INFLUX_TELEMETRY_DB, timestamp);
+            return;
+        }
+
+        // the per-field series have always been stored as floats
+        this->writeValue(INFLUX_BATTERY_DB, KEY_TEMPERATURE, CATEGORY_BATTERY, (double)battery_status.temperature, timestamp);
+        this->writeValue(INFLUX_BATTERY_DB, KEY_CHARGE_STATE, CATEGORY_BATTERY, (double)battery_status.charge_state, timestamp);
+        this->writeValue(INFLUX_BATTERY_DB, KEY_CURRENT_BATTERY, CATEGORY_BATTERY, (double)battery_status.current_battery, timestamp);
     }
     catch(const std::exception& e)
     {
         printf("[ERROR] Can't push batterie data. Dropping record.\n");
     }
+}
+
+void InfluxDB_Interface::pushOdometry(const mavlink_odometry_t &odometry, int sysid, int compid, uint64_t rx_usec)
+{
+    uint64_t timestamp = pointTime(sysid, compid, rx_usec, odometry.time_usec);
+    this->beginFields(MEAS_ODOMETRY, sysid, compid, timestamp);
+
     try
     {
-        this->influx[INFLUX_ODOMETRY_DB]->write(influxdb::Point{"x"}.addTag("category", "estimator").addField("value", messages.odometry.x));
-        this->influx[INFLUX_ODOMETRY_DB]->write(influxdb::Point{"y"}.addTag("category", "estimator").addField("value", messages.odometry.y));
-        this->influx[INFLUX_ODOMETRY_DB]->write(influxdb::Point{"z"}.addTag("category", "estimator").addField("value", messages.odometry.z));
-        this->influx[INFLUX_ODOMETRY_DB]->write(influxdb::Point{"vx"}.addTag("category", "estimator").addField("value", messages.odometry.vx));
-        this->influx[INFLUX_ODOMETRY_DB]->write(influxdb::Point{"vy"}.addTag("category", "estimator").addField("value", messages.odometry.vy));
-        this->influx[INFLUX_ODOMETRY_DB]->write(influxdb::Point{"vz"}.addTag("category", "estimator").addField("value", messages.odometry.vz));
-        this->influx[INFLUX_ODOMETRY_DB]->write(influxdb::Point{"rollspeed"}.addTag("category", "estimator").addField("value", messages.odometry.rollspeed));
-        this->influx[INFLUX_ODOMETRY_DB]->write(influxdb::Point{"pitchspeed"}.addTag("category", "estimator").addField("value", messages.odometry.pitchspeed));
-        this->influx[INFLUX_ODOMETRY_DB]->write(influxdb::Point{"yawspeed"}.addTag("category", "estimator").addField("value", messages.odometry.yawspeed));
+        if (this->schema == INFLUX_SCHEMA_MESSAGE)
+        {
+            Line_Buffer &point = this->beginMessage(MEAS_ODOMETRY, sysid, compid);
+            this->writeField(point, KEY_X, odometry.x);
+            this->writeField(point, KEY_Y, odometry.y);
+            this->writeField(point, KEY_Z, odometry.z);
+            this->writeField(point, KEY_VX, odometry.vx);
+            this->writeField(point, KEY_VY, odometry.vy);
+            this->writeField(point, KEY_VZ, odometry.vz);
+            this->writeField(point, KEY_ROLLSPEED, odometry.rollspeed);
+            this->writeField(point, KEY_PITCHSPEED, odometry.pitchspeed);
+            this->writeField(point, KEY_YAWSPEED, odometry.yawspeed);
+            this->commit(INFLUX_TELEMETRY_DB, timestamp);
+            return;
+        }
+
+        this->writeValue(INFLUX_ODOMETRY_DB, KEY_X, CATEGORY_ESTIMATOR, odometry.x, timestamp);
+        this->writeValue(INFLUX_ODOMETRY_DB, KEY_Y, CATEGORY_ESTIMATOR, odometry.y, timestamp);
+        this->writeValue(INFLUX_ODOMETRY_DB, KEY_Z, CATEGORY_ESTIMATOR, odometry.z, timestamp);
+        this->writeValue(INFLUX_ODOMETRY_DB, KEY_VX, CATEGORY_ESTIMATOR, odometry.vx, timestamp);
+        this->writeValue(INFLUX_ODOMETRY_DB, KEY_VY, CATEGORY_ESTIMATOR, odometry.vy, timestamp);
+        this->writeValue(INFLUX_ODOMETRY_DB, KEY_VZ, CATEGORY_ESTIMATOR, odometry.vz, timestamp);
+        this->writeValue(INFLUX_ODOMETRY_DB, KEY_ROLLSPEED, CATEGORY_ESTIMATOR, odometry.rollspeed, timestamp);
+        this->writeValue(INFLUX_ODOMETRY_DB, KEY_PITCHSPEED, CATEGORY_ESTIMATOR, odometry.pitchspeed, timestamp);
+        this->writeValue(INFLUX_ODOMETRY_DB, KEY_YAWSPEED, CATEGORY_ESTIMATOR, odometry.yawspeed, timestamp);
     }
     catch(const std::exception& e)
     {
         printf("[ERROR] Can't push odometry data. Dropping record.\n");
     }
+}
+
+void InfluxDB_Interface::pushVibration(const mavlink_vibration_t &vibration, int sysid, int compid, uint64_t rx_usec)
+{
+    uint64_t timestamp = pointTime(sysid, compid, rx_usec, vibration.time_usec);
+    this->beginFields(MEAS_VIBRATION, sysid, compid, timestamp);
+
     try
     {
-        this->influx[INFLUX_VIBRATION_DB]->write(influxdb::Point{"vibration_x"}.addTag("category", "estimator").addField("value", messages.vibration.vibration_x));
-        this->influx[INFLUX_VIBRATION_DB]->write(influxdb::Point{"vibration_y"}.addTag("category", "estimator").addField("value", messages.vibration.vibration_y));
-        this->influx[INFLUX_VIBRATION_DB]->write(influxdb::Point{"vibration_z"}.addTag("category", "estimator").addField("value", messages.vibration.vibration_z));
-        this->influx[INFLUX_VIBRATION_DB]->write(influxdb::Point{"clipping_0"}.addTag("category", "estimator").addField("value", messages.vibration.clipping_0));
-        this->influx[INFLUX_VIBRATION_DB]->write(influxdb::Point{"clipping_1"}.addTag("category", "estimator").addField("value", messages.vibration.clipping_1));
-        this->influx[INFLUX_VIBRATION_DB]->write(influxdb::Point{"clipping_2"}.addTag("category", "estimator").addField("value", messages.vibration.clipping_2));
+        if (this->schema == INFLUX_SCHEMA_MESSAGE)
+        {
+            Line_Buffer &point = this->beginMessage(MEAS_VIBRATION, sysid, compid);
+            this->writeField(point, KEY_VIBRATION_X, vibration.vibration_x);
+            this->writeField(point, KEY_VIBRATION_Y, vibration.vibration_y);
+            this->writeField(point, KEY_VIBRATION_Z, vibration.vibration_z);
+            this->writeFieldInt(point, KEY_CLIPPING_0, vibration.clipping_0);
+            this->writeFieldInt(point, KEY_CLIPPING_1, vibration.clipping_1);
+            this->writeFieldInt(point, KEY_CLIPPING_2, vibration.clipping_2);
+            this->commit(INFLUX_TELEMETRY_DB, timestamp);
+            return;
+        }
 
+        this->writeValue(INFLUX_VIBRATION_DB, KEY_VIBRATION_X, CATEGORY_ESTIMATOR, vibration.vibration_x, timestamp);
+        this->writeValue(INFLUX_VIBRATION_DB, KEY_VIBRATION_Y, CATEGORY_ESTIMATOR, vibration.vibration_y, timestamp);
+        this->writeValue(INFLUX_VIBRATION_DB, KEY_VIBRATION_Z, CATEGORY_ESTIMATOR, vibration.vibration_z, timestamp);
+        this->writeInt(INFLUX_VIBRATION_DB, KEY_CLIPPING_0, CATEGORY_ESTIMATOR, vibration.clipping_0, timestamp);
+        this->writeInt(INFLUX_VIBRATION_DB, KEY_CLIPPING_1, CATEGORY_ESTIMATOR, vibration.clipping_1, timestamp);
+        this->writeInt(INFLUX_VIBRATION_DB, KEY_CLIPPING_2, CATEGORY_ESTIMATOR, vibration.clipping_2, timestamp);
     }
     catch(const std::exception& e)
     {
         printf("[ERROR] Can't push vibrations data. Dropping record.\n");
     }
-    
-    try 
+}
+
+void InfluxDB_Interface::pushGps(const mavlink_gps_raw_int_t &gps_raw, int sysid, int compid, uint64_t rx_usec)
+{
+    uint64_t timestamp = pointTime(sysid, compid, rx_usec, gps_raw.time_usec);
+    this->beginFields(MEAS_GPS_RAW_INT, sysid, compid, timestamp);
+
+    try
     {
-        if (messages.gps_raw.satellites_visible > 0)
+        if (gps_raw.satellites_visible > 0)
         {
 
-            double alt = messages.gps_raw.alt / 1000.00;
-            double lat = messages.gps_raw.lat / 10000000.00;
-            double lon = messages.gps_raw.lon / 10000000.00;
-            
-            this->influx[INFLUX_ATTITUDE_DB]->write(influxdb::Point{"position"}.addTag("category", "estimator")
-            .addField("latitude", lat)
-            .addField("longitude", lon)
-            .addField("altitude", alt));
+            double alt = gps_raw.alt / 1000.00;
+            double lat = gps_raw.lat / 10000000.00;
+            double lon = gps_raw.lon / 10000000.00;
+
+            if (this->schema == INFLUX_SCHEMA_MESSAGE)
+            {
+                Line_Buffer &point = this->beginMessage(MEAS_GPS_RAW_INT, sysid, compid);
+                this->writeField(point, KEY_LATITUDE, lat);
+                this->writeField(point, KEY_LONGITUDE, lon);
+                this->writeField(point, KEY_ALTITUDE, alt);
+                this->writeFieldInt(point, KEY_SATELLITES_VISIBLE, gps_raw.satellites_visible);
+                this->commit(INFLUX_TELEMETRY_DB, timestamp);
+                return;
+            }
+
+            Line_Buffer &point = this->batch[INFLUX_ATTITUDE_DB]->lines;
+            point.measurement(KEY_POSITION);
+            point.tag(KEY_CATEGORY, CATEGORY_ESTIMATOR);
+            point.tag(KEY_COMPID, compid);
+            point.tag(KEY_SYSID, sysid);
+            this->writeField(point, KEY_LATITUDE, lat);
+            this->writeField(point, KEY_LONGITUDE, lon);
+            this->writeField(point, KEY_ALTITUDE, alt);
+            this->commit(INFLUX_ATTITUDE_DB, timestamp);
 
         }
     }
@@ -143,6 +645,344 @@ void InfluxDB_Interface::pushData(Mavlink_Messages messages)
     {
         printf("[ERROR] Can't push gps data. Dropping record.\n");
     }
+}
 
-    return;
-}
\ No newline at end of file
+void InfluxDB_Interface::pushTimesync(const mavlink_timesync_t &timesync, int sysid, int compid, uint64_t rx_usec)
+{
+    // a reply: ts1 is when we asked, on our clock, and tc1 when the vehicle
+    // answered, on its own; requests have no tc1
+    int64_t rtt_ns = (int64_t)rx_usec * 1000 - timesync.ts1;
+    if (timesync.tc1 <= 0 || timesync.ts1 <= 0 || rtt_ns < 0 || rtt_ns > TIMESYNC_MAX_RTT_NS)
+    {
+        return;
+    }
+
+    // the vehicle answered halfway if the link is as slow both ways, which
+    // makes this a sample of its clock without the link delay
+    uint64_t sent_usec = timesync.ts1 / 1000;
+    uint64_t middle_usec = sent_usec + (rx_usec - sent_usec) / 2;
+    uint64_t vehicle_usec = timesync.tc1 / 1000;
+
+    // vehicle time minus host monotonic time, its trend is the drift
+    int64_t offset_usec = (int64_t)vehicle_usec - (int64_t)middle_usec;
+
+    uint64_t timestamp = pointTime(sysid, compid, middle_usec, vehicle_usec);
+    this->beginFields(MEAS_LINK_TIMING, sysid, compid, timestamp);
+
+    try
+    {
+        Line_Buffer &point = this->beginMessage(MEAS_LINK_TIMING, sysid, compid);
+        this->writeFieldInt(point, KEY_RTT_US, rtt_ns / 1000);
+        this->writeFieldInt(point, KEY_LATENCY_US, rtt_ns / 2000);
+        this->writeFieldInt(point, KEY_CLOCK_OFFSET_US, offset_usec);
+        this->commit(INFLUX_TELEMETRY_DB, timestamp);
+    }
+    catch(const std::exception& e)
+    {
+        printf("[ERROR] Can't push link timing. Dropping record.\n");
+    }
+}
+
+// a field of a payload, which is packed and may not be aligned
+template <typename T>
+static inline T loadField(const uint8_t *data)
+{
+    T value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// the point of one exported message, fields go through the decimator and
+// rollups like those of the other writers
+struct InfluxDB_Interface::Export_Fields
+{
+    InfluxDB_Interface &influx;
+    int sysid;
+    int compid;
+    uint64_t rx_usec;
+    uint64_t timestamp;
+    Line_Buffer *point;
+
+    // vehicle_usec is the time the message carries, 0 if none
+    void begin(const Line_Key &measurement, uint64_t vehicle_usec)
+    {
+        timestamp = influx.pointTime(sysid, compid, rx_usec, vehicle_usec);
+        influx.beginFields(measurement, sysid, compid, timestamp);
+        point = &influx.beginMessage(measurement, sysid, compid);
+    }
+
+    void field(const Line_Key &key, float value) { influx.writeField(*point, key, value); }
+    void field(const Line_Key &key, double value) { influx.writeField(*point, key, value); }
+    void field_int(const Line_Key &key, int64_t value) { influx.writeFieldInt(*point, key, value); }
+    void field_string(const Line_Key &key, const char *value, size_t len) { point->field_string(key, value, len); }
+
+    void end() { influx.commit(INFLUX_TELEMETRY_DB, timestamp); }
+};
+
+void InfluxDB_Interface::pushExport(const Mavlink_Event &event, const Export_Message &message)
+{
+    Export_Fields out = { *this, event.message.sysid, event.message.compid, event.time_usec, 0, NULL };
+
+    try
+    {
+#ifdef HAVE_LINE_ENCODERS
+        // offsets and names fixed when the dialect was generated
+        if (encode_mavlink_line(out, event.message))
+        {
+            return;
+        }
+#endif
+
+        // truncated MAVLink 2 payloads were zero filled by the parser
+        const uint8_t *payload = (const uint8_t *)_MAV_PAYLOAD(&event.message);
+
+        uint64_t vehicle_usec = 0;
+        if (message.time_scale == 1)
+        {
+            vehicle_usec = loadField<uint64_t>(payload + message.time_offset);
+        }
+        else if (message.time_scale == 1000)
+        {
+            vehicle_usec = loadField<uint32_t>(payload + message.time_offset) * 1000ULL;
+        }
+        out.begin(*message.measurement, vehicle_usec);
+
+        for (const Export_Field &field : message.fields)
+        {
+            const uint8_t *data = payload + field.offset;
+            const Line_Key *const *key = &message.keys[field.key];
+
+            if (field.text)
+            {
+                out.field_string(**key, (const char *)data, field.count);
+                continue;
+            }
+
+            for (int i = 0; i < field.count; i++, data += field.size, key++)
+            {
+                switch (field.type)
+                {
+                    case MAVLINK_TYPE_CHAR:
+                    case MAVLINK_TYPE_INT8_T:   out.field_int(**key, (int8_t)*data); break;
+                    case MAVLINK_TYPE_UINT8_T:  out.field_int(**key, *data); break;
+                    case MAVLINK_TYPE_UINT16_T: out.field_int(**key, loadField<uint16_t>(data)); break;
+                    case MAVLINK_TYPE_INT16_T:  out.field_int(**key, loadField<int16_t>(data)); break;
+                    case MAVLINK_TYPE_UINT32_T: out.field_int(**key, loadField<uint32_t>(data)); break;
+                    case MAVLINK_TYPE_INT32_T:  out.field_int(**key, loadField<int32_t>(data)); break;
+                    case MAVLINK_TYPE_UINT64_T: out.field_int(**key, (int64_t)loadField<uint64_t>(data)); break;
+                    case MAVLINK_TYPE_INT64_T:  out.field_int(**key, loadField<int64_t>(data)); break;
+                    case MAVLINK_TYPE_FLOAT:    out.field(**key, loadField<float>(data)); break;
+                    case MAVLINK_TYPE_DOUBLE:   out.field(**key, loadField<double>(data)); break;
+                }
+            }
+        }
+
+        out.end();
+    }
+    catch(const std::exception& e)
+    {
+        printf("[ERROR] Can't push exported data. Dropping record.\n");
+    }
+}
+
+// time of a point in nanoseconds, from the vehicle's clock if the message
+// carries its time since boot, else from when it was received
+uint64_t InfluxDB_Interface::pointTime(int sysid, int compid, uint64_t rx_usec, uint64_t vehicle_usec)
+{
+    // kept state that never arrived
+    if (rx_usec == 0)
+    {
+        rx_usec = get_time_usec();
+    }
+
+    if (!this->vehicle_time || vehicle_usec == 0 || vehicle_usec >= VEHICLE_CLOCK_MAX_BOOT_USEC)
+    {
+        return wall_nsec(rx_usec);
+    }
+
+    Vehicle_Clock *clock = this->clocks.insert(sysid, compid, [](Vehicle_Clock &) {});
+    if (clock == NULL)
+    {
+        return wall_nsec(rx_usec);
+    }
+
+    bool synced = clock->synced();
+    if (!clock->sample(vehicle_usec, rx_usec) && synced)
+    {
+        printf("[INFO] Clock of component %i:%i went back, a reboot? Syncing again.\n", sysid, compid);
+    }
+
+    return wall_nsec(clock->to_host(vehicle_usec));
+}
+
+void InfluxDB_Interface::beginFields(const Line_Key &measurement, int sysid, int compid, uint64_t timestamp)
+{
+    this->message_sysid = sysid;
+    this->message_compid = compid;
+
+    this->decimator.begin(this->cursor, measurement, sysid, compid, timestamp);
+    this->rollup.begin(this->rollup_cursor, measurement, sysid, compid, timestamp);
+
+    // windows this message is past are written before it joins the next ones
+    writeRollups(this->rollup_cursor, sysid, compid);
+}
+
+void InfluxDB_Interface::writeRollups(Rollup_Cursor &cursor, int sysid, int compid)
+{
+    for (int tier = 0; tier < ROLLUP_TIERS; tier++)
+    {
+        if (!this->rollup.closed(cursor, tier))
+        {
+            continue;
+        }
+
+        int db = INFLUX_ROLLUP_DB + tier;
+        Line_Buffer &point = this->batch[db]->lines;
+        point.measurement(this->rollup.measurement(cursor, tier));
+        point.tag(KEY_SYSID, sysid);
+        point.tag(KEY_COMPID, compid);
+        this->commit(db, this->rollup.write(point, cursor, tier));
+    }
+}
+
+void InfluxDB_Interface::closeRollups(uint64_t now)
+{
+    this->rollup.close(now, [this](Rollup_Cursor &cursor, int sysid, int compid) {
+        writeRollups(cursor, sysid, compid);
+    });
+}
+
+Line_Buffer &InfluxDB_Interface::beginMessage(const Line_Key &measurement, int sysid, int compid)
+{
+    Line_Buffer &point = this->batch[INFLUX_TELEMETRY_DB]->lines;
+
+    point.measurement(measurement);
+    point.tag(KEY_SYSID, sysid);
+    point.tag(KEY_COMPID, compid);
+
+    return point;
+}
+
+void InfluxDB_Interface::writeValue(int db, const Line_Key &name, const Line_Key &category, float value, uint64_t timestamp)
+{
+    this->batch[db]->lines.measurement(name);
+    this->batch[db]->lines.tag(KEY_CATEGORY, category);
+    this->batch[db]->lines.tag(KEY_COMPID, this->message_compid);
+    this->batch[db]->lines.tag(KEY_SYSID, this->message_sysid);
+    this->rollup.sample(this->rollup_cursor, name, value, false);
+    this->decimator.field(this->batch[db]->lines, this->cursor, name, KEY_VALUE, value);
+    this->commit(db, timestamp);
+}
+
+void InfluxDB_Interface::writeValue(int db, const Line_Key &name, const Line_Key &category, double value, uint64_t timestamp)
+{
+    this->batch[db]->lines.measurement(name);
+    this->batch[db]->lines.tag(KEY_CATEGORY, category);
+    this->batch[db]->lines.tag(KEY_COMPID, this->message_compid);
+    this->batch[db]->lines.tag(KEY_SYSID, this->message_sysid);
+    this->rollup.sample(this->rollup_cursor, name, value, false);
+    this->decimator.field(this->batch[db]->lines, this->cursor, name, KEY_VALUE, value);
+    this->commit(db, timestamp);
+}
+
+void InfluxDB_Interface::writeInt(int db, const Line_Key &name, const Line_Key &category, int64_t value, uint64_t timestamp)
+{
+    this->batch[db]->lines.measurement(name);
+    this->batch[db]->lines.tag(KEY_CATEGORY, category);
+    this->batch[db]->lines.tag(KEY_COMPID, this->message_compid);
+    this->batch[db]->lines.tag(KEY_SYSID, this->message_sysid);
+    this->rollup.sample(this->rollup_cursor, name, (double)value, true);
+    this->decimator.field_int(this->batch[db]->lines, this->cursor, name, KEY_VALUE, value);
+    this->commit(db, timestamp);
+}
+
+void InfluxDB_Interface::writeField(Line_Buffer &point, const Line_Key &name, float value)
+{
+    this->rollup.sample(this->rollup_cursor, name, value, false);
+    this->decimator.field(point, this->cursor, name, name, value);
+}
+
+void InfluxDB_Interface::writeField(Line_Buffer &point, const Line_Key &name, double value)
+{
+    this->rollup.sample(this->rollup_cursor, name, value, false);
+    this->decimator.field(point, this->cursor, name, name, value);
+}
+
+void InfluxDB_Interface::writeFieldInt(Line_Buffer &point, const Line_Key &name, int64_t value)
+{
+    this->rollup.sample(this->rollup_cursor, name, (double)value, true);
+    this->decimator.field_int(point, this->cursor, name, name, value);
+}
+
+void InfluxDB_Interface::commit(int db, uint64_t timestamp)
+{
+    bool first = this->batch[db]->lines.empty();
+
+    if (!this->batch[db]->lines.end(timestamp))
+    {
+        return;
+    }
+
+    if (first)
+    {
+        this->batch_start[db] = get_time_usec();
+    }
+
+    // over UDP too, a batch of many datagrams leaves in a few sendmmsg calls
+    if (this->batch[db]->lines.points() >= this->batch_size)
+    {
+        flush(db);
+    }
+}
+
+void InfluxDB_Interface::flush(int db)
+{
+    if (this->batch[db]->lines.empty())
+    {
+        return;
+    }
+
+    if (!this->connected[db])
+    {
+        printf("[ERROR] Can't push %s batch, not connected. Dropping %zu points.\n", this->databases[db].c_str(), this->batch[db]->lines.points());
+        this->batch[db]->lines.clear();
+        return;
+    }
+
+    if (this->output == INFLUX_OUTPUT_UDP)
+    {
+        this->sinks->udp.send(this->batch[db]->lines);
+        this->batch[db]->lines.clear();
+        return;
+    }
+
+    // the writer owns the batch from now on, keep filling a fresh one
+    this->batch[db] = this->sinks->writer.submit(this->batch[db]);
+}
+
+void InfluxDB_Interface::flushDue()
+{
+    uint64_t now = get_time_usec();
+
+    // windows of vehicles that went quiet
+    closeRollups(wall_nsec(now));
+
+    for (int i = 0; i < INFLUX_DB_COUNT; i++)
+    {
+        if (!this->batch[i]->lines.empty() && now - this->batch_start[i] >= (uint64_t)this->flush_interval_ms * 1000)
+        {
+            flush(i);
+        }
+    }
+}
+
+void InfluxDB_Interface::flushAll()
+{
+    // the windows still open would be lost
+    closeRollups(0);
+
+    for (int i = 0; i < INFLUX_DB_COUNT; i++)
+    {
+        flush(i);
+    }
+}
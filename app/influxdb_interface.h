@@ -8,8 +8,17 @@
 #define INFLUXDB_INTERFACE_H
 
 #include <string>
-#include <InfluxDBFactory.h>
+#include <vector>
+#include <stdexcept>
 #include "autopilot_interface.h"
+#include "line_protocol.h"
+#include "influx_writer.h"
+#include "influx_udp.h"
+#include "decimator.h"
+#include "rollup.h"
+#include "message_exporter.h"
+#include "vehicle_clock.h"
+#include "vehicle_table.h"
 
 #define INFLUX_IMU_DB 0
 #define INFLUX_ALTITUDE_DB 1
@@ -18,6 +27,20 @@
 #define INFLUX_ODOMETRY_DB 4
 #define INFLUX_VIBRATION_DB 5
 #define INFLUX_GPS_DB 6
+#define INFLUX_TELEMETRY_DB 7
+// one per rollup tier, in telemetry_db
+#define INFLUX_ROLLUP_DB 8
+#define INFLUX_DB_COUNT (INFLUX_ROLLUP_DB + ROLLUP_TIERS)
+
+// one measurement per field in per-category databases
+#define INFLUX_SCHEMA_LEGACY 0
+// one point per message, all fields together, in a single database
+#define INFLUX_SCHEMA_MESSAGE 1
+
+// batches posted over HTTP by the writer threads
+#define INFLUX_OUTPUT_HTTP 0
+// batches sent as datagrams to a UDP listener, nothing is acknowledged
+#define INFLUX_OUTPUT_UDP 1
 
 
 class InfluxDB_Interface
@@ -26,24 +49,128 @@ private:
     int port;
     std::string server_addr;
 
-    std::string databases[7] = {
+    std::string databases[INFLUX_DB_COUNT] = {
         "imu_db",
         "altitude_db",
         "attitude_db",
         "battery_db",
         "odometry_db",
         "vibration_db",
-        "gps_db"
+        "gps_db",
+        "telemetry",
+        "telemetry",
+        "telemetry",
+        "telemetry"
     };
 
-    std::unique_ptr<influxdb::InfluxDB> influx[6];
+    bool connected[INFLUX_DB_COUNT];
+
+    // owner of the writer and UDP socket the batches go to, this one unless
+    // attached to another
+    InfluxDB_Interface *sinks;
+
+    // points being filled as line protocol, one batch per database
+    Influx_Batch *batch[INFLUX_DB_COUNT];
+    uint64_t batch_start[INFLUX_DB_COUNT];
+
+    // fields of the message being written, all its points are tagged with
+    // the component it came from
+    int message_sysid;
+    int message_compid;
+    Decimation_Cursor cursor;
+    Rollup_Cursor rollup_cursor;
+
+    // vehicle time to host time, per component
+    Vehicle_Table<Vehicle_Clock> clocks;
+
+    void connect(int db);
+
+    uint64_t pointTime(int sysid, int compid, uint64_t rx_usec, uint64_t vehicle_usec);
+
+    void beginFields(const Line_Key &measurement, int sysid, int compid, uint64_t timestamp);
+    void writeRollups(Rollup_Cursor &cursor, int sysid, int compid);
+    // windows that ended before now, all of them with now 0
+    void closeRollups(uint64_t now);
+    Line_Buffer &beginMessage(const Line_Key &measurement, int sysid, int compid);
+    void writeValue(int db, const Line_Key &name, const Line_Key &category, float value, uint64_t timestamp);
+    void writeValue(int db, const Line_Key &name, const Line_Key &category, double value, uint64_t timestamp);
+    void writeInt(int db, const Line_Key &name, const Line_Key &category, int64_t value, uint64_t timestamp);
+    void writeField(Line_Buffer &point, const Line_Key &name, float value);
+    void writeField(Line_Buffer &point, const Line_Key &name, double value);
+    void writeFieldInt(Line_Buffer &point, const Line_Key &name, int64_t value);
+    void commit(int db, uint64_t timestamp);
+    void flush(int db);
+
+    void pushImu(const mavlink_highres_imu_t &highres_imu, int sysid, int compid, uint64_t rx_usec);
+    void pushAltitude(const mavlink_altitude_t &altitude, int sysid, int compid, uint64_t rx_usec);
+    void pushAttitude(const mavlink_attitude_t &attitude, int sysid, int compid, uint64_t rx_usec);
+    void pushBattery(const mavlink_battery_status_t &battery_status, int sysid, int compid, uint64_t rx_usec);
+    void pushOdometry(const mavlink_odometry_t &odometry, int sysid, int compid, uint64_t rx_usec);
+    void pushVibration(const mavlink_vibration_t &vibration, int sysid, int compid, uint64_t rx_usec);
+    void pushGps(const mavlink_gps_raw_int_t &gps_raw, int sysid, int compid, uint64_t rx_usec);
+    void pushTimesync(const mavlink_timesync_t &timesync, int sysid, int compid, uint64_t rx_usec);
+    void pushExport(const Mavlink_Event &event, const Export_Message &message);
+
+    // what the generated encoders write through, see pushExport()
+    struct Export_Fields;
 
 public:
     InfluxDB_Interface(std::string server_addr, int port);
     ~InfluxDB_Interface();
 
+    // a batch is sent as one request once it holds batch_size points
+    // or its oldest point is flush_interval_ms old
+    size_t batch_size;
+    int flush_interval_ms;
+
+    // INFLUX_SCHEMA_LEGACY or INFLUX_SCHEMA_MESSAGE, the latter writes to telemetry_db
+    int schema;
+    std::string telemetry_db;
+
+    // points are stamped with the time the vehicle gave the message, mapped
+    // to the host clock, or when that is off or the message has none with
+    // the time it was received
+    bool vehicle_time;
+
+    // round trip, latency and clock offset of the link from the replies to
+    // the autopilot's TIMESYNC requests, in telemetry_db
+    bool link_timing;
+
+    // INFLUX_OUTPUT_HTTP or INFLUX_OUTPUT_UDP, the latter sends to udp_port
+    int output;
+    int udp_port;
+
+    // per field rates and modes, every sample is written without rules
+    Decimator decimator;
+
+    // 1 s, 10 s and 60 s aggregates of every field, off by default
+    Rollup rollup;
+
+    // messages without a writer of their own, written field by field to
+    // telemetry_db by the encoders generated from the MAVLink XML, or from
+    // their MAVLink description without them; none by default
+    Message_Exporter exporter;
+
+    // sends the batches in the background, configure before init()
+    Influx_Writer writer;
+
+    // sends the batches right away when output is INFLUX_OUTPUT_UDP
+    Influx_Udp udp;
+
     void init();
-    void pushData(Mavlink_Messages messages);
+
+    // fills batches of its own for the sinks of shared, which init() has
+    // set up; for threads writing in parallel
+    void attach(InfluxDB_Interface &shared);
+    // batches that got old and rollup windows of messages that stopped
+    void flushDue();
+    // everything, open rollup windows too, before shutting down
+    void flushAll();
+    // the messages written, as events for pushMessage() or as kept state
+    // for pushData()
+    void subscribe(Autopilot_Interface &autopilot_interface, int sinks = MESSAGE_SINK_QUEUE);
+    void pushData(Autopilot_Interface &autopilot_interface);
+    void pushMessage(const Mavlink_Event &event);
 };
 
 
@@ -0,0 +1,259 @@
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "line_protocol.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <charconv>
+#include <new>
+
+
+// ----------------------------------------------------------------------------------
+//   Line Key Class
+// ----------------------------------------------------------------------------------
+Line_Key::
+Line_Key(const char *name, bool measurement)
+{
+	for ( const char *c = name; *c; c++ )
+	{
+		if ( *c == ',' || *c == ' ' || (*c == '=' && !measurement) )
+		{
+			text += '\\';
+		}
+		text += *c;
+	}
+}
+
+Line_Key::
+Line_Key(const Line_Key &base, const char *suffix, bool measurement)
+	: Line_Key(suffix, measurement)
+{
+	text.insert(0, base.text);
+}
+
+
+// ----------------------------------------------------------------------------------
+//   Line Buffer Class
+// ----------------------------------------------------------------------------------
+
+// longest number to_chars can produce, with the 'i' suffix
+#define LINE_NUMBER_MAX 32
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Line_Buffer::
+Line_Buffer(size_t capacity_)
+{
+	capacity = capacity_ > 0 ? capacity_ : 1;
+	buf = (char *)malloc(capacity);
+	if ( buf == NULL )
+	{
+		throw std::bad_alloc();
+	}
+
+	len         = 0;
+	point_start = 0;
+	point_count = 0;
+	field_count = 0;
+}
+
+Line_Buffer::
+~Line_Buffer()
+{
+	free(buf);
+}
+
+void
+Line_Buffer::
+clear()
+{
+	len         = 0;
+	point_start = 0;
+	point_count = 0;
+	field_count = 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Point
+// ------------------------------------------------------------------------------
+void
+Line_Buffer::
+measurement(const Line_Key &name)
+{
+	point_start = len;
+	field_count = 0;
+
+	_append(name.data(), name.size());
+}
+
+void
+Line_Buffer::
+tag(const Line_Key &key, const Line_Key &value)
+{
+	_reserve(key.size() + value.size() + 2);
+
+	buf[len++] = ',';
+	memcpy(buf + len, key.data(), key.size());
+	len += key.size();
+	buf[len++] = '=';
+	memcpy(buf + len, value.data(), value.size());
+	len += value.size();
+}
+
+void
+Line_Buffer::
+tag(const Line_Key &key, int64_t value)
+{
+	_reserve(key.size() + LINE_NUMBER_MAX + 2);
+
+	buf[len++] = ',';
+	memcpy(buf + len, key.data(), key.size());
+	len += key.size();
+	buf[len++] = '=';
+	len = std::to_chars(buf + len, buf + capacity, value).ptr - buf;
+}
+
+void
+Line_Buffer::
+field(const Line_Key &key, float value)
+{
+	if ( !isfinite(value) )
+	{
+		return;
+	}
+
+	_field_key(key);
+
+	// shortest form that reads back as the same float, not the double expansion
+	len = std::to_chars(buf + len, buf + capacity, value).ptr - buf;
+}
+
+void
+Line_Buffer::
+field(const Line_Key &key, double value)
+{
+	if ( !isfinite(value) )
+	{
+		return;
+	}
+
+	_field_key(key);
+	len = std::to_chars(buf + len, buf + capacity, value).ptr - buf;
+}
+
+void
+Line_Buffer::
+field_int(const Line_Key &key, int64_t value)
+{
+	_field_key(key);
+	len = std::to_chars(buf + len, buf + capacity, value).ptr - buf;
+	buf[len++] = 'i';
+}
+
+void
+Line_Buffer::
+field_string(const Line_Key &key, const char *value, size_t value_len)
+{
+	_field_key(key);
+	_reserve(2 * value_len + 2);
+
+	buf[len++] = '"';
+	for ( size_t i = 0; i < value_len && value[i] != '\0'; i++ )
+	{
+		char c = value[i];
+		if ( c == '"' || c == '\\' )
+		{
+			buf[len++] = '\\';
+		}
+		// a newline would end the point early
+		buf[len++] = (c == '\n' || c == '\r') ? ' ' : c;
+	}
+	buf[len++] = '"';
+}
+
+bool
+Line_Buffer::
+end(uint64_t timestamp_ns)
+{
+	// a point needs at least one field
+	if ( field_count == 0 )
+	{
+		len = point_start;
+		return false;
+	}
+
+	_reserve(LINE_NUMBER_MAX + 2);
+
+	buf[len++] = ' ';
+	len = std::to_chars(buf + len, buf + capacity, timestamp_ns).ptr - buf;
+	buf[len++] = '\n';
+
+	point_count++;
+
+	return true;
+}
+
+void
+Line_Buffer::
+append_lines(const char *data, size_t size, size_t points)
+{
+	_append(data, size);
+
+	point_start  = len;
+	point_count += points;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+
+// separator and key of a field, with room left for its value
+void
+Line_Buffer::
+_field_key(const Line_Key &key)
+{
+	_reserve(key.size() + LINE_NUMBER_MAX + 2);
+
+	buf[len++] = field_count++ == 0 ? ' ' : ',';
+	memcpy(buf + len, key.data(), key.size());
+	len += key.size();
+	buf[len++] = '=';
+}
+
+void
+Line_Buffer::
+_append(const char *data, size_t size)
+{
+	_reserve(size);
+
+	memcpy(buf + len, data, size);
+	len += size;
+}
+
+void
+Line_Buffer::
+_grow(size_t needed)
+{
+	size_t new_capacity = capacity;
+	while ( new_capacity < needed )
+	{
+		new_capacity *= 2;
+	}
+
+	char *new_buf = (char *)realloc(buf, new_capacity);
+	if ( new_buf == NULL )
+	{
+		throw std::bad_alloc();
+	}
+
+	buf      = new_buf;
+	capacity = new_capacity;
+}
@@ -0,0 +1,125 @@
+#ifndef LINE_PROTOCOL_H_
+#define LINE_PROTOCOL_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+
+// ----------------------------------------------------------------------------------
+//   Line Key Class
+// ----------------------------------------------------------------------------------
+/*
+ * Line Key Class
+ *
+ * A measurement name, tag key, tag value or field key, escaped once for the
+ * line protocol when it is built. Keys are meant to be created at startup and
+ * kept, writing them to a buffer is then a plain copy.
+ */
+class Line_Key
+{
+
+public:
+
+	// measurement names only escape commas and spaces, everything else also '='
+	explicit Line_Key(const char *name, bool measurement = false);
+
+	// base followed by suffix, such as a field name with "_min"
+	Line_Key(const Line_Key &base, const char *suffix, bool measurement = false);
+
+	const char *data() const { return text.data(); }
+	size_t      size() const { return text.size(); }
+
+private:
+
+	std::string text;
+
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Line Buffer Class
+// ----------------------------------------------------------------------------------
+/*
+ * Line Buffer Class
+ *
+ * Arena holding a batch of points in InfluxDB line protocol, ready to be sent
+ * as a request body. A point is written as
+ *
+ *     measurement(key) tag(key, value)... field(key, value)... end(timestamp)
+ *
+ * Numbers are formatted with std::to_chars, integers get the 'i' suffix. The
+ * storage only grows and is kept by clear(), so once it has reached the size
+ * of a full batch no more allocation happens.
+ *
+ * NaN and infinite values can't be written in line protocol, such fields are
+ * left out. A point left without any field is discarded by end().
+ */
+class Line_Buffer
+{
+
+public:
+
+	Line_Buffer(size_t capacity = 64 * 1024);
+	~Line_Buffer();
+
+	Line_Buffer(const Line_Buffer &) = delete;
+	Line_Buffer &operator=(const Line_Buffer &) = delete;
+
+	void measurement(const Line_Key &name);
+
+	void tag(const Line_Key &key, const Line_Key &value);
+	void tag(const Line_Key &key, int64_t value);
+
+	void field(const Line_Key &key, float value);
+	void field(const Line_Key &key, double value);
+	void field_int(const Line_Key &key, int64_t value);
+
+	// up to len chars or the first NUL, quoted and escaped
+	void field_string(const Line_Key &key, const char *value, size_t len);
+
+	// timestamp in nanoseconds, returns false if the point was discarded
+	bool end(uint64_t timestamp_ns);
+
+	// complete lines encoded elsewhere, such as a batch read back from disk
+	void append_lines(const char *data, size_t size, size_t points);
+
+	void clear();
+
+	const char *data()   const { return buf; }
+	size_t      size()   const { return len; }
+	size_t      points() const { return point_count; }
+	bool        empty()  const { return point_count == 0; }
+
+private:
+
+	char  *buf;
+	size_t capacity;
+	size_t len;
+
+	size_t point_start;
+	size_t point_count;
+	int    field_count;
+
+	void _reserve(size_t extra)
+	{
+		if ( len + extra > capacity )
+		{
+			_grow(len + extra);
+		}
+	}
+
+	void _grow(size_t needed);
+
+	void _append(const char *data, size_t size);
+	void _field_key(const Line_Key &key);
+
+};
+
+
+
+#endif // LINE_PROTOCOL_H_
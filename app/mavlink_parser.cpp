@@ -0,0 +1,363 @@
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "mavlink_parser.h"
+
+#include <string.h>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+
+// ------------------------------------------------------------------------------
+//   STX Scan
+// ------------------------------------------------------------------------------
+// Returns the offset of the first MAVLink 1 or 2 start marker in data, or len
+// if there is none. Works on 16 bytes at a time where SSE2 or NEON is there.
+static size_t
+find_stx(const uint8_t *data, size_t len)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i stx_v1 = _mm_set1_epi8((char)MAVLINK_STX_MAVLINK1);
+	const __m128i stx_v2 = _mm_set1_epi8((char)MAVLINK_STX);
+
+	for ( ; i + 16 <= len; i += 16 )
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, stx_v1),
+		                                          _mm_cmpeq_epi8(chunk, stx_v2)));
+		if ( mask )
+		{
+			return i + __builtin_ctz(mask);
+		}
+	}
+#elif defined(__ARM_NEON)
+	const uint8x16_t stx_v1 = vdupq_n_u8(MAVLINK_STX_MAVLINK1);
+	const uint8x16_t stx_v2 = vdupq_n_u8(MAVLINK_STX);
+
+	for ( ; i + 16 <= len; i += 16 )
+	{
+		uint8x16_t chunk = vld1q_u8(data + i);
+		uint8x16_t match = vorrq_u8(vceqq_u8(chunk, stx_v1), vceqq_u8(chunk, stx_v2));
+
+		// narrow to 4 bits per byte to get a scalar mask
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+		if ( mask )
+		{
+			return i + (__builtin_ctzll(mask) >> 2);
+		}
+	}
+#endif
+
+	for ( ; i < len; i++ )
+	{
+		if ( data[i] == MAVLINK_STX || data[i] == MAVLINK_STX_MAVLINK1 )
+		{
+			return i;
+		}
+	}
+
+	return len;
+}
+
+
+// ----------------------------------------------------------------------------------
+//   MAVLink Parser Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Mavlink_Parser::
+Mavlink_Parser()
+{
+	reset();
+}
+
+void
+Mavlink_Parser::
+reset()
+{
+	memset(&status, 0, sizeof(status));
+	pending_len = 0;
+
+	memset(&char_status, 0, sizeof(char_status));
+	char_status.parse_state = MAVLINK_PARSE_STATE_IDLE;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Parse a Span
+// ------------------------------------------------------------------------------
+// Calls back for every complete frame in data, returns the number of frames.
+int
+Mavlink_Parser::
+parse(const uint8_t *data, size_t len, const Message_Callback &callback)
+{
+	int received = 0;
+
+	// --------------------------------------------------------------------------
+	//   FINISH PENDING FRAME
+	// --------------------------------------------------------------------------
+
+	// The pending tail is always shorter than one frame, so appending up to
+	// the buffer size is enough to either complete it or prove it garbage.
+	// Once the old bytes are used up, parsing goes on in the caller's buffer.
+	while ( pending_len > 0 && len > 0 )
+	{
+		size_t old_len = pending_len;
+		size_t take    = std::min(len, sizeof(pending) - pending_len);
+
+		memcpy(pending + pending_len, data, take);
+		pending_len += take;
+
+		size_t tail = _parse_span(pending, pending_len, callback, received);
+
+		if ( tail >= old_len )
+		{
+			data += tail - old_len;
+			len  -= tail - old_len;
+			pending_len = 0;
+		}
+		else
+		{
+			memmove(pending, pending + tail, pending_len - tail);
+			pending_len -= tail;
+			data += take;
+			len  -= take;
+		}
+	}
+
+	// --------------------------------------------------------------------------
+	//   PARSE IN PLACE
+	// --------------------------------------------------------------------------
+	if ( len > 0 )
+	{
+		size_t tail = _parse_span(data, len, callback, received);
+
+		// keep the incomplete frame for the next span
+		pending_len = len - tail;
+		memcpy(pending, data + tail, pending_len);
+	}
+
+	return received;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Parse a Byte
+// ------------------------------------------------------------------------------
+// Same as mavlink_parse_char(), on the instance's own frame buffer instead of
+// a global channel. True when c completed a message, copied to out.
+bool
+Mavlink_Parser::
+parse_char(uint8_t c, mavlink_message_t &out)
+{
+	mavlink_status_t frame_status;
+	uint8_t result = mavlink_frame_char_buffer(&char_message, &char_status, c, &out, &frame_status);
+
+	if ( result == MAVLINK_FRAMING_OK )
+	{
+		status.packet_rx_success_count++;
+		return true;
+	}
+
+	// a bad frame is dropped, its last byte may start the next one
+	if ( result == MAVLINK_FRAMING_BAD_CRC || result == MAVLINK_FRAMING_BAD_SIGNATURE )
+	{
+		status.packet_rx_drop_count++;
+
+		char_status.msg_received = MAVLINK_FRAMING_INCOMPLETE;
+		char_status.parse_state  = MAVLINK_PARSE_STATE_IDLE;
+		if ( c == MAVLINK_STX )
+		{
+			char_status.parse_state = MAVLINK_PARSE_STATE_GOT_STX;
+			char_message.len = 0;
+			mavlink_start_checksum(&char_message);
+		}
+	}
+
+	return false;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Parse Frames in a Buffer
+// ------------------------------------------------------------------------------
+// Returns the offset of the incomplete frame at the end of data, len if none.
+size_t
+Mavlink_Parser::
+_parse_span(const uint8_t *data, size_t len, const Message_Callback &callback, int &received)
+{
+	size_t pos = 0;
+
+	while ( pos < len )
+	{
+		pos += find_stx(data + pos, len - pos);
+		if ( pos >= len )
+		{
+			break;
+		}
+
+		const mavlink_msg_entry_t *entry = NULL;
+		int frame_len = _frame_length(data + pos, len - pos, entry);
+
+		// need more bytes
+		if ( frame_len == 0 || (frame_len > 0 && (size_t)frame_len > len - pos) )
+		{
+			return pos;
+		}
+
+		if ( frame_len < 0 )
+		{
+			status.parse_error++;
+		}
+		else if ( _decode_frame(data + pos, entry) )
+		{
+			status.packet_rx_success_count++;
+			received++;
+			callback(message);
+			pos += frame_len;
+			continue;
+		}
+		else
+		{
+			status.packet_rx_drop_count++;
+		}
+
+		// not a frame, resync on the next marker
+		pos++;
+	}
+
+	return len;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Check Header
+// ------------------------------------------------------------------------------
+// Returns the full frame length, 0 if the header is not complete yet or -1 if
+// the header can't be a valid frame (unknown message, impossible length).
+int
+Mavlink_Parser::
+_frame_length(const uint8_t *frame, size_t avail, const mavlink_msg_entry_t *&entry)
+{
+	// MAVLink 2
+	if ( frame[0] == MAVLINK_STX )
+	{
+		if ( avail < MAVLINK_NUM_HEADER_BYTES )
+		{
+			return 0;
+		}
+
+		uint8_t payload_len    = frame[1];
+		uint8_t incompat_flags = frame[2];
+		if ( incompat_flags & ~MAVLINK_IFLAG_SIGNED )
+		{
+			return -1;
+		}
+
+		uint32_t msgid = frame[7] | (frame[8] << 8) | (frame[9] << 16);
+		entry = mavlink_get_msg_entry(msgid);
+
+		// trailing zeros may be truncated, so only the maximum is fixed
+		if ( entry == NULL || payload_len > entry->max_msg_len )
+		{
+			return -1;
+		}
+
+		int signature_len = (incompat_flags & MAVLINK_IFLAG_SIGNED) ? MAVLINK_SIGNATURE_BLOCK_LEN : 0;
+		return MAVLINK_NUM_HEADER_BYTES + payload_len + MAVLINK_NUM_CHECKSUM_BYTES + signature_len;
+	}
+
+	// MAVLink 1
+	if ( avail < MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1 )
+	{
+		return 0;
+	}
+
+	uint8_t payload_len = frame[1];
+
+	entry = mavlink_get_msg_entry(frame[5]);
+	if ( entry == NULL || payload_len < entry->min_msg_len || payload_len > entry->max_msg_len )
+	{
+		return -1;
+	}
+
+	return MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1 + payload_len + MAVLINK_NUM_CHECKSUM_BYTES;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Decode Frame
+// ------------------------------------------------------------------------------
+// Checks the CRC of a complete frame and unpacks it into message.
+bool
+Mavlink_Parser::
+_decode_frame(const uint8_t *frame, const mavlink_msg_entry_t *entry)
+{
+	bool    is_v2       = frame[0] == MAVLINK_STX;
+	uint8_t payload_len = frame[1];
+	size_t  header_len  = is_v2 ? MAVLINK_NUM_HEADER_BYTES : MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1;
+
+	const uint8_t *payload = frame + header_len;
+	const uint8_t *ck      = payload + payload_len;
+
+	// the CRC covers everything between STX and the checksum, then crc_extra
+	uint16_t crc = crc_calculate(frame + 1, header_len - 1 + payload_len);
+	crc_accumulate(entry->crc_extra, &crc);
+
+	if ( ck[0] != (crc & 0xFF) || ck[1] != (crc >> 8) )
+	{
+		return false;
+	}
+
+	message.magic = frame[0];
+	message.len   = payload_len;
+
+	if ( is_v2 )
+	{
+		message.incompat_flags = frame[2];
+		message.compat_flags   = frame[3];
+		message.seq            = frame[4];
+		message.sysid          = frame[5];
+		message.compid         = frame[6];
+		message.msgid          = frame[7] | (frame[8] << 8) | (frame[9] << 16);
+	}
+	else
+	{
+		message.incompat_flags = 0;
+		message.compat_flags   = 0;
+		message.seq            = frame[2];
+		message.sysid          = frame[3];
+		message.compid         = frame[4];
+		message.msgid          = frame[5];
+	}
+
+	// zero fill truncated MAVLink 2 payloads like mavlink_parse_char() does
+	memcpy(_MAV_PAYLOAD_NON_CONST(&message), payload, payload_len);
+	if ( payload_len < entry->max_msg_len )
+	{
+		memset(_MAV_PAYLOAD_NON_CONST(&message) + payload_len, 0, entry->max_msg_len - payload_len);
+	}
+
+	message.checksum = crc;
+	message.ck[0]    = ck[0];
+	message.ck[1]    = ck[1];
+
+	if ( message.incompat_flags & MAVLINK_IFLAG_SIGNED )
+	{
+		memcpy(message.signature, ck + MAVLINK_NUM_CHECKSUM_BYTES, MAVLINK_SIGNATURE_BLOCK_LEN);
+	}
+
+	return true;
+}
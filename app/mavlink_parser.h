@@ -0,0 +1,76 @@
+#ifndef MAVLINK_PARSER_H_
+#define MAVLINK_PARSER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+#include <common/mavlink.h>
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+// called once for every complete frame found in a span
+typedef std::function<void(const mavlink_message_t &message)> Message_Callback;
+
+
+// ----------------------------------------------------------------------------------
+//   MAVLink Parser Class
+// ----------------------------------------------------------------------------------
+/*
+ * MAVLink Parser Class
+ *
+ * Decodes every complete MAVLink 1 and 2 frame found in a contiguous buffer,
+ * such as a whole UDP datagram or a serial read chunk. Frame starts are found
+ * with a vectorized scan for the STX markers, the header is checked against
+ * the known message lengths and the CRC is computed over the whole frame at
+ * once. Anything that fails is skipped one byte at a time until the next
+ * marker. A frame cut at the end of a span is kept and completed by the next
+ * call to parse().
+ *
+ * Unlike mavlink_parse_char() the state is owned by the instance, there is no
+ * shared channel: every port and listener thread decodes with its own parser
+ * and none of them needs a lock. parse_char() is the byte at a time path for
+ * callers that read single bytes, it keeps its own frame state apart from
+ * parse().
+ */
+class Mavlink_Parser
+{
+
+public:
+
+	Mavlink_Parser();
+
+	int  parse(const uint8_t *data, size_t len, const Message_Callback &callback);
+	bool parse_char(uint8_t c, mavlink_message_t &out);
+	void reset();
+
+	// packet_rx_success_count, packet_rx_drop_count and parse_error are kept
+	// up to date, the rest of the struct is unused
+	mavlink_status_t status;
+
+private:
+
+	uint8_t pending[2 * MAVLINK_MAX_PACKET_LEN];
+	size_t  pending_len;
+
+	mavlink_message_t message;
+
+	// parse_char() frame in progress, what the MAVLink channel would hold
+	mavlink_message_t char_message;
+	mavlink_status_t  char_status;
+
+	size_t _parse_span(const uint8_t *data, size_t len, const Message_Callback &callback, int &received);
+	int    _frame_length(const uint8_t *frame, size_t avail, const mavlink_msg_entry_t *&entry);
+	bool   _decode_frame(const uint8_t *frame, const mavlink_msg_entry_t *entry);
+
+};
+
+
+
+#endif // MAVLINK_PARSER_H_
@@ -0,0 +1,253 @@
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "message_exporter.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+
+#ifndef MAVLINK_HAVE_GET_MESSAGE_INFO
+#error "the exporter needs the MAVLink message info, build with -DMAVLINK_USE_MESSAGE_INFO"
+#endif
+
+
+// bytes of one element of each MAVLINK_TYPE_*
+static const uint8_t TYPE_SIZE[] = { 1, 1, 1, 2, 2, 4, 4, 8, 8, 4, 8 };
+
+// every message of the dialects, walked when all of them are exported
+static const mavlink_message_info_t MESSAGE_INFO[] = MAVLINK_MESSAGE_INFO;
+
+
+// ----------------------------------------------------------------------------------
+//   Message Exporter Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Message_Exporter::
+Message_Exporter()
+{
+	allow_all = false;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Rules
+// ------------------------------------------------------------------------------
+bool
+Message_Exporter::
+allow(const char *names)
+{
+	if ( strcmp(names, "all") == 0 )
+	{
+		allow_all = true;
+	}
+	else if ( !_parse_names(names, allowed) )
+	{
+		return false;
+	}
+
+	_reset();
+	return true;
+}
+
+bool
+Message_Exporter::
+deny(const char *names)
+{
+	if ( !_parse_names(names, denied) )
+	{
+		return false;
+	}
+
+	// a deny list alone exports everything else
+	if ( allowed.empty() )
+	{
+		allow_all = true;
+	}
+
+	_reset();
+	return true;
+}
+
+void
+Message_Exporter::
+copy_rules(const Message_Exporter &other)
+{
+	allow_all = other.allow_all;
+	allowed   = other.allowed;
+	denied    = other.denied;
+
+	_reset();
+}
+
+// message names to msgids, appended to ids
+bool
+Message_Exporter::
+_parse_names(const char *names, std::vector<uint32_t> &ids)
+{
+	std::string list(names);
+	size_t start = 0;
+
+	while ( start <= list.size() )
+	{
+		size_t comma = list.find(',', start);
+		if ( comma == std::string::npos )
+		{
+			comma = list.size();
+		}
+
+		std::string name = list.substr(start, comma - start);
+		start = comma + 1;
+
+		if ( name.empty() )
+		{
+			continue;
+		}
+
+		// MAVLink names are upper case
+		for ( char &c : name )
+		{
+			c = toupper((unsigned char)c);
+		}
+
+		const mavlink_message_info_t *info = mavlink_get_message_info_by_name(name.c_str());
+		if ( info == NULL )
+		{
+			printf("[ERROR] Unknown MAVLink message %s\n", name.c_str());
+			return false;
+		}
+		ids.push_back(info->msgid);
+	}
+
+	return true;
+}
+
+bool
+Message_Exporter::
+_exported(uint32_t msgid) const
+{
+	if ( std::find(denied.begin(), denied.end(), msgid) != denied.end() )
+	{
+		return false;
+	}
+
+	return allow_all || std::find(allowed.begin(), allowed.end(), msgid) != allowed.end();
+}
+
+// drops the tables and builds those of the exported messages again, none
+// is built on the hot path
+void
+Message_Exporter::
+_reset()
+{
+	messages.clear();
+	storage.clear();
+	keys.clear();
+
+	if ( allow_all )
+	{
+		for ( const mavlink_message_info_t &info : MESSAGE_INFO )
+		{
+			if ( _exported(info.msgid) )
+			{
+				_build(info.msgid);
+			}
+		}
+		return;
+	}
+
+	for ( uint32_t msgid : allowed )
+	{
+		_build(msgid);
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Tables
+// ------------------------------------------------------------------------------
+const Export_Message *
+Message_Exporter::
+_build(uint32_t msgid)
+{
+	if ( msgid >= messages.size() )
+	{
+		messages.resize(msgid + 1, NULL);
+	}
+
+	storage.emplace_back();
+	Export_Message &message = storage.back();
+	messages[msgid] = &message;
+
+	const mavlink_message_info_t *info = mavlink_get_message_info_by_id(msgid);
+
+	message.exported    = info != NULL && _exported(msgid);
+	message.measurement = NULL;
+	message.time_offset = 0;
+	message.time_scale  = 0;
+	if ( !message.exported )
+	{
+		return NULL;
+	}
+
+	std::string name(info->name);
+	for ( char &c : name )
+	{
+		c = tolower((unsigned char)c);
+	}
+	keys.emplace_back(name.c_str(), true);
+	message.measurement = &keys.back();
+
+	for ( unsigned i = 0; i < info->num_fields; i++ )
+	{
+		const mavlink_field_info_t &source = info->fields[i];
+		if ( (unsigned)source.type >= sizeof(TYPE_SIZE) )
+		{
+			continue;
+		}
+
+		if ( strcmp(source.name, "time_usec") == 0 && source.type == MAVLINK_TYPE_UINT64_T )
+		{
+			message.time_offset = source.wire_offset;
+			message.time_scale  = 1;
+		}
+		else if ( strcmp(source.name, "time_boot_ms") == 0 && source.type == MAVLINK_TYPE_UINT32_T && message.time_scale == 0 )
+		{
+			message.time_offset = source.wire_offset;
+			message.time_scale  = 1000;
+		}
+
+		Export_Field field;
+		field.offset = source.wire_offset;
+		field.type   = source.type;
+		field.size   = TYPE_SIZE[source.type];
+		field.count  = source.array_length > 0 ? source.array_length : 1;
+		field.text   = source.type == MAVLINK_TYPE_CHAR && source.array_length > 0;
+		field.key    = message.keys.size();
+
+		if ( field.text || field.count == 1 )
+		{
+			keys.emplace_back(source.name);
+			message.keys.push_back(&keys.back());
+		}
+		else
+		{
+			for ( unsigned element = 0; element < field.count; element++ )
+			{
+				std::string key = std::string(source.name) + "_" + std::to_string(element);
+				keys.emplace_back(key.c_str());
+				message.keys.push_back(&keys.back());
+			}
+		}
+
+		message.fields.push_back(field);
+	}
+
+	return &message;
+}
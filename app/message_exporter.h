@@ -0,0 +1,125 @@
+#ifndef MESSAGE_EXPORTER_H_
+#define MESSAGE_EXPORTER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+#include <common/mavlink.h>
+#include <development/mavlink.h>
+
+#include "line_protocol.h"
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// one field of a message, where it is in the payload and how it is written
+struct Export_Field
+{
+	uint16_t offset;   // in the payload, elements follow each other
+	uint8_t  type;     // MAVLINK_TYPE_*
+	uint8_t  size;     // of one element
+	uint16_t count;    // elements, 1 for a scalar
+	bool     text;     // char array, written as one string field
+	uint16_t key;      // first of its keys in Export_Message::keys
+};
+
+// everything needed to write one kind of message, built once
+struct Export_Message
+{
+	bool exported;
+	const Line_Key *measurement;
+
+	// where the vehicle time is, time_usec or time_boot_ms; time_scale to
+	// microseconds is 0 if the message has neither
+	uint16_t time_offset;
+	uint16_t time_scale;
+	std::vector<Export_Field> fields;
+
+	// one per element, <field>_<index> for arrays
+	std::vector<const Line_Key *> keys;
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Message Exporter Class
+// ----------------------------------------------------------------------------------
+/*
+ * Message Exporter Class
+ *
+ * Writes any MAVLink message as one point, from the field descriptors the
+ * MAVLink library generates with the messages (mavlink_message_info_t). The
+ * measurement is the message name in lower case, every field becomes a field
+ * of the point:
+ *
+ *     integers and enums      integer fields, enums by their value
+ *     float, double           float fields
+ *     arrays                  one field per element, <field>_0, <field>_1...
+ *     char arrays             one string field
+ *
+ * Which messages are exported is given by name, comma separated:
+ *
+ *     allow("all")                      every message
+ *     allow("HEARTBEAT,SYS_STATUS")     only these
+ *     deny("PARAM_VALUE")               every message but these
+ *
+ * The offsets, types and escaped keys of every exported message are worked
+ * out when the rules are set, walking the message table of the library when
+ * all are exported, and kept in a table indexed by msgid. Writing a message
+ * is then a loop over its fields with no lookup by name. Needs MAVLINK_USE_MESSAGE_INFO defined
+ * for the MAVLink headers.
+ */
+class Message_Exporter
+{
+
+public:
+
+	Message_Exporter();
+
+	// false for a message name MAVLink doesn't know
+	bool allow(const char *names);
+	bool deny(const char *names);
+
+	void copy_rules(const Message_Exporter &other);
+
+	bool enabled() const { return allow_all || !allowed.empty(); }
+
+	// every message may be exported, else only those in allowed_ids()
+	bool exports_all() const { return allow_all; }
+	const std::vector<uint32_t> &allowed_ids() const { return allowed; }
+
+	// NULL if the message isn't exported
+	const Export_Message *find(uint32_t msgid) const
+	{
+		if ( msgid < messages.size() && messages[msgid] != NULL && messages[msgid]->exported )
+			return messages[msgid];
+		return NULL;
+	}
+
+private:
+
+	bool allow_all;
+	std::vector<uint32_t> allowed;
+	std::vector<uint32_t> denied;
+
+	// by msgid, NULL for a message that isn't exported
+	std::vector<Export_Message *> messages;
+	std::deque<Export_Message> storage;
+	std::deque<Line_Key> keys;
+
+	bool _parse_names(const char *names, std::vector<uint32_t> &ids);
+	bool _exported(uint32_t msgid) const;
+	const Export_Message *_build(uint32_t msgid);
+	void _reset();
+
+};
+
+
+
+#endif // MESSAGE_EXPORTER_H_
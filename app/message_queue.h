@@ -0,0 +1,183 @@
+#ifndef MESSAGE_QUEUE_H_
+#define MESSAGE_QUEUE_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// ----------------------------------------------------------------------------------
+//   Message Queue Class
+// ----------------------------------------------------------------------------------
+/*
+ * Message Queue Class
+ *
+ * Bounded lock-free ring for one producer thread and one consumer thread.
+ * push() and pop() never block or allocate; when the ring is full the new
+ * item is dropped and counted. wait_pop() lets the consumer sleep while the
+ * ring is empty, the producer only touches the mutex when somebody sleeps.
+ * Large items can be written and read in place with claim()/publish() and
+ * front()/release() instead of being copied.
+ */
+template <typename T>
+class Message_Queue
+{
+public:
+
+	// capacity is rounded up to a power of two
+	Message_Queue(size_t capacity_)
+	{
+		size_t capacity = 1;
+		while ( capacity < capacity_ )
+			capacity <<= 1;
+
+		ring.resize(capacity);
+		mask = capacity - 1;
+
+		head = 0;
+		tail = 0;
+		drop_count = 0;
+		waiting = false;
+	}
+
+	// producer side
+	bool push(const T &item)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+
+		if ( t - head.load(std::memory_order_acquire) > mask )
+		{
+			drop_count.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		ring[t & mask] = item;
+
+		// sequentially consistent, pairs with the consumer setting waiting
+		tail.store(t + 1);
+
+		if ( waiting.load() )
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			cond.notify_one();
+		}
+
+		return true;
+	}
+
+	// producer side, in place: fill the slot claim() returns, then publish()
+	// it; NULL (and counted as dropped) when the ring is full
+	T *claim()
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+
+		if ( t - head.load(std::memory_order_acquire) > mask )
+		{
+			drop_count.fetch_add(1, std::memory_order_relaxed);
+			return NULL;
+		}
+
+		return &ring[t & mask];
+	}
+
+	void publish()
+	{
+		tail.store(tail.load(std::memory_order_relaxed) + 1);
+
+		if ( waiting.load() )
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			cond.notify_one();
+		}
+	}
+
+	// consumer side, in place: the item front() returns stays valid until
+	// release()
+	T *front()
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+
+		if ( h == tail.load(std::memory_order_acquire) )
+			return NULL;
+
+		return &ring[h & mask];
+	}
+
+	void release()
+	{
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// consumer side
+	bool pop(T &item)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+
+		if ( h == tail.load(std::memory_order_acquire) )
+			return false;
+
+		item = ring[h & mask];
+		head.store(h + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// consumer side, false if still empty after timeout_ms
+	bool wait_pop(T &item, int timeout_ms)
+	{
+		if ( pop(item) )
+			return true;
+
+		wait(timeout_ms);
+
+		return pop(item);
+	}
+
+	// consumer side, sleeps until an item is queued or timeout_ms passed
+	bool wait(int timeout_ms)
+	{
+		if ( head.load(std::memory_order_relaxed) != tail.load(std::memory_order_acquire) )
+			return true;
+
+		std::unique_lock<std::mutex> lock(mutex);
+		waiting.store(true);
+		bool ready = cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+			return head.load(std::memory_order_relaxed) != tail.load();
+		});
+		waiting.store(false);
+
+		return ready;
+	}
+
+	uint64_t dropped() const
+	{
+		return drop_count.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	std::vector<T> ring;
+	size_t mask;
+
+	// separate cache lines, each index is written by one side only
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+
+	std::atomic<uint64_t> drop_count;
+
+	std::atomic<bool> waiting;
+	std::mutex mutex;
+	std::condition_variable cond;
+
+};
+
+
+
+#endif // MESSAGE_QUEUE_H_
@@ -0,0 +1,104 @@
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "message_registry.h"
+
+#include "autopilot_interface.h"
+
+
+// ------------------------------------------------------------------------------
+//   Decoders
+// ------------------------------------------------------------------------------
+
+// one instance per kept message, the decoder and both members are resolved at
+// compile time
+template <typename T, T Mavlink_Messages::*Member, uint64_t Time_Stamps::*Stamp,
+          void (*Decode)(const mavlink_message_t *, T *)>
+static void
+store_message(const mavlink_message_t &message, Mavlink_Messages &messages, uint64_t time_usec)
+{
+	Decode(&message, &(messages.*Member));
+	messages.time_stamps.*Stamp = time_usec;
+}
+
+#define MESSAGE_INFO(NAME, name, member) \
+	static const mavlink_message_info_t name##_info = MAVLINK_MESSAGE_INFO_##NAME;
+MAVLINK_KEPT_MESSAGES(MESSAGE_INFO)
+#undef MESSAGE_INFO
+
+
+// ------------------------------------------------------------------------------
+//   Registry
+// ------------------------------------------------------------------------------
+
+static const Message_Entry entries[] = {
+#define MESSAGE_ENTRY(NAME, name, member)                                          \
+	{ MAVLINK_MSG_ID_##NAME, #NAME,                                                \
+	  &store_message<mavlink_##name##_t, &Mavlink_Messages::member,                \
+	                 &Time_Stamps::member, &mavlink_msg_##name##_decode>,          \
+	  &Time_Stamps::member, &name##_info },
+	MAVLINK_KEPT_MESSAGES(MESSAGE_ENTRY)
+#undef MESSAGE_ENTRY
+};
+
+static constexpr uint32_t kept_ids[] = {
+#define MESSAGE_ID(NAME, name, member) MAVLINK_MSG_ID_##NAME,
+	MAVLINK_KEPT_MESSAGES(MESSAGE_ID)
+#undef MESSAGE_ID
+};
+
+static constexpr size_t entry_count = sizeof(kept_ids) / sizeof(kept_ids[0]);
+static_assert(entry_count < 256, "entry indices are kept in a byte");
+
+static constexpr uint32_t
+max_kept_id()
+{
+	uint32_t max = 0;
+	for ( size_t i = 0; i < entry_count; i++ )
+		max = kept_ids[i] > max ? kept_ids[i] : max;
+	return max;
+}
+
+// msgid to entry index + 1, 0 for messages that aren't kept; built by the
+// compiler, a few hundred bytes for the common set
+struct Message_Index {
+	uint8_t slot[max_kept_id() + 1];
+};
+
+static constexpr Message_Index
+make_index()
+{
+	Message_Index index = {};
+	for ( size_t i = 0; i < entry_count; i++ )
+		index.slot[kept_ids[i]] = (uint8_t)(i + 1);
+	return index;
+}
+
+static constexpr Message_Index message_index = make_index();
+
+
+// ------------------------------------------------------------------------------
+//   Lookup
+// ------------------------------------------------------------------------------
+const Message_Entry *
+find_message_entry(uint32_t msgid)
+{
+	if ( msgid > max_kept_id() )
+		return NULL;
+
+	uint8_t slot = message_index.slot[msgid];
+	return slot ? &entries[slot - 1] : NULL;
+}
+
+size_t
+message_entry_count()
+{
+	return entry_count;
+}
+
+const Message_Entry *
+message_entry(size_t index)
+{
+	return &entries[index];
+}
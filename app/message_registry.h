@@ -0,0 +1,83 @@
+#ifndef MESSAGE_REGISTRY_H_
+#define MESSAGE_REGISTRY_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <common/mavlink.h>
+#include <development/mavlink.h>
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+/*
+ * Messages kept per component
+ *
+ * One line per message: its MAVLink name, the lower case name of its type and
+ * decoder, and the member holding it in Mavlink_Messages and Time_Stamps.
+ * The line is all it takes to keep one more message, the members, the decoder
+ * and the dispatch entry are generated from it.
+ */
+#define MAVLINK_KEPT_MESSAGES(X) \
+	X(HEARTBEAT,                  heartbeat,                  heartbeat)                  \
+	X(SYS_STATUS,                 sys_status,                 sys_status)                 \
+	X(BATTERY_STATUS,             battery_status,             battery_status)             \
+	X(RADIO_STATUS,               radio_status,               radio_status)               \
+	X(LOCAL_POSITION_NED,         local_position_ned,         local_position_ned)         \
+	X(GLOBAL_POSITION_INT,        global_position_int,        global_position_int)        \
+	X(POSITION_TARGET_LOCAL_NED,  position_target_local_ned,  position_target_local_ned)  \
+	X(POSITION_TARGET_GLOBAL_INT, position_target_global_int, position_target_global_int) \
+	X(HIGHRES_IMU,                highres_imu,                highres_imu)                \
+	X(ATTITUDE,                   attitude,                   attitude)                   \
+	X(ATTITUDE_QUATERNION,        attitude_quaternion,        attitude_quaternion)        \
+	X(ESTIMATOR_STATUS,           estimator_status,           estimator_status)           \
+	X(ODOMETRY,                   odometry,                   odometry)                   \
+	X(VIBRATION,                  vibration,                  vibration)                  \
+	X(ALTITUDE,                   altitude,                   altitude)                   \
+	X(GPS_RTK,                    gps_rtk,                    gps_rtk)                    \
+	X(GPS_GLOBAL_ORIGIN,          gps_global_origin,          gps_global_origin)          \
+	X(GPS_RAW_INT,                gps_raw_int,                gps_raw)                    \
+	X(GPS_STATUS,                 gps_status,                 gps_status)
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+struct Mavlink_Messages;
+struct Time_Stamps;
+
+// everything known about a kept message
+struct Message_Entry {
+
+	uint32_t msgid;
+	const char *name;
+
+	// decodes into the message's member of messages and stamps it
+	void (*store)(const mavlink_message_t &message, Mavlink_Messages &messages, uint64_t time_usec);
+
+	uint64_t Time_Stamps::*stamp;
+
+	// field descriptors, as generated with the message
+	const mavlink_message_info_t *info;
+
+};
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+// entry of a kept message, NULL for any other; a flat array lookup
+const Message_Entry *find_message_entry(uint32_t msgid);
+
+// all kept messages, in the order of MAVLINK_KEPT_MESSAGES
+size_t message_entry_count();
+const Message_Entry *message_entry(size_t index);
+
+
+
+#endif // MESSAGE_REGISTRY_H_
@@ -0,0 +1,228 @@
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "rollup.h"
+
+#include <string.h>
+#include <math.h>
+
+
+// ------------------------------------------------------------------------------
+//   Tiers
+// ------------------------------------------------------------------------------
+
+static const uint64_t TIER_PERIOD_NS[ROLLUP_TIERS] = {
+	1000000000ULL,
+	10000000000ULL,
+	60000000000ULL
+};
+
+static const char *TIER_SUFFIX[ROLLUP_TIERS] = { "_1s", "_10s", "_60s" };
+static const char *TIER_POLICY[ROLLUP_TIERS] = { "rollup_1s", "rollup_10s", "rollup_60s" };
+
+static const char *STAT_SUFFIX[ROLLUP_STATS] = { "_count", "_mean", "_min", "_max", "_last" };
+
+
+// ----------------------------------------------------------------------------------
+//   Rollup Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Rollup::
+Rollup()
+{
+	enabled            = false;
+	retention_policies = false;
+	next_close         = 0;
+}
+
+const char *
+Rollup::
+tier_policy(int tier)
+{
+	return TIER_POLICY[tier];
+}
+
+
+// ------------------------------------------------------------------------------
+//   Messages
+// ------------------------------------------------------------------------------
+void
+Rollup::
+begin(Rollup_Cursor &cursor, const Line_Key &measurement, int sysid, int compid, uint64_t now)
+{
+	cursor.index = 0;
+
+	if ( !enabled )
+	{
+		cursor.message = NULL;
+		return;
+	}
+
+	Message_Key key;
+	key.sysid       = sysid;
+	key.compid      = compid;
+	key.measurement = &measurement;
+
+	auto found = messages.find(key);
+	if ( found == messages.end() )
+	{
+		Rollup_Message message;
+		for ( int tier = 0; tier < ROLLUP_TIERS; tier++ )
+		{
+			// with retention policies the tier is in the policy, not the name
+			message.measurements[tier] = retention_policies ? &measurement : _key(measurement, TIER_SUFFIX[tier], true);
+			message.window[tier]       = now - now % TIER_PERIOD_NS[tier];
+			message.closed_start[tier] = 0;
+		}
+		message.closed = 0;
+
+		found = messages.emplace(key, message).first;
+	}
+
+	Rollup_Message &message = found->second;
+	cursor.message = &message;
+
+	// windows past their end are closed before this message is added
+	message.closed = 0;
+	for ( int tier = 0; tier < ROLLUP_TIERS; tier++ )
+	{
+		// late ones join the window close() moved on to
+		uint64_t window = now - now % TIER_PERIOD_NS[tier];
+		if ( window <= message.window[tier] )
+		{
+			continue;
+		}
+
+		message.closed_start[tier] = message.window[tier];
+		message.window[tier]       = window;
+		message.closed            |= 1 << tier;
+	}
+}
+
+uint64_t
+Rollup::
+write(Line_Buffer &point, Rollup_Cursor &cursor, int tier)
+{
+	Rollup_Message &message = *cursor.message;
+
+	for ( Rollup_Field &field : message.fields )
+	{
+		Rollup_Accumulator &acc = field.tiers[tier];
+		if ( acc.count == 0 )
+		{
+			continue;
+		}
+
+		point.field_int(*field.keys[ROLLUP_COUNT], acc.count);
+		point.field(*field.keys[ROLLUP_MEAN], acc.sum / acc.count);
+		if ( field.integer )
+		{
+			point.field_int(*field.keys[ROLLUP_MIN], llround(acc.min));
+			point.field_int(*field.keys[ROLLUP_MAX], llround(acc.max));
+			point.field_int(*field.keys[ROLLUP_LAST], llround(acc.last));
+		}
+		else
+		{
+			point.field(*field.keys[ROLLUP_MIN], acc.min);
+			point.field(*field.keys[ROLLUP_MAX], acc.max);
+			point.field(*field.keys[ROLLUP_LAST], acc.last);
+		}
+
+		acc.count = 0;
+	}
+
+	message.closed &= ~(1 << tier);
+	return message.closed_start[tier];
+}
+
+
+// ------------------------------------------------------------------------------
+//   Fields
+// ------------------------------------------------------------------------------
+void
+Rollup::
+sample(Rollup_Cursor &cursor, const Line_Key &name, double value, bool integer)
+{
+	if ( cursor.message == NULL )
+	{
+		return;
+	}
+
+	std::vector<Rollup_Field> &fields = cursor.message->fields;
+
+	// first time through this message
+	if ( cursor.index == fields.size() )
+	{
+		Rollup_Field field;
+		memset(&field, 0, sizeof(field));
+		for ( int stat = 0; stat < ROLLUP_STATS; stat++ )
+		{
+			field.keys[stat] = _key(name, STAT_SUFFIX[stat], false);
+		}
+		field.integer = integer;
+
+		fields.push_back(field);
+	}
+
+	Rollup_Field &field = fields[cursor.index++];
+
+	// NaN can't be written and would poison the window
+	if ( isnan(value) || isinf(value) )
+	{
+		return;
+	}
+
+	for ( int tier = 0; tier < ROLLUP_TIERS; tier++ )
+	{
+		Rollup_Accumulator &acc = field.tiers[tier];
+		if ( acc.count == 0 )
+		{
+			acc.sum = 0;
+			acc.min = value;
+			acc.max = value;
+		}
+		acc.count++;
+		acc.sum += value;
+		acc.min  = fmin(acc.min, value);
+		acc.max  = fmax(acc.max, value);
+		acc.last = value;
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+// marks the windows to close, true if there is one
+bool
+Rollup::
+_close(Rollup_Message &message, uint64_t now)
+{
+	message.closed = 0;
+	for ( int tier = 0; tier < ROLLUP_TIERS; tier++ )
+	{
+		uint64_t end = message.window[tier] + TIER_PERIOD_NS[tier];
+		if ( now && end + ROLLUP_GRACE_NS > now )
+		{
+			continue;
+		}
+
+		message.closed_start[tier] = message.window[tier];
+		message.window[tier]       = now ? now - now % TIER_PERIOD_NS[tier] : end;
+		message.closed            |= 1 << tier;
+	}
+
+	return message.closed != 0;
+}
+
+const Line_Key *
+Rollup::
+_key(const Line_Key &base, const char *suffix, bool measurement)
+{
+	keys.emplace_back(base, suffix, measurement);
+	return &keys.back();
+}
@@ -0,0 +1,189 @@
+#ifndef ROLLUP_H_
+#define ROLLUP_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "line_protocol.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// 1 s, 10 s and 60 s windows
+#define ROLLUP_TIERS 3
+
+// a window nobody closed is closed this long after its end, points may be
+// stamped a little in the past
+#define ROLLUP_GRACE_NS 2000000000ULL
+
+// fields written per input field and tier
+#define ROLLUP_COUNT 0
+#define ROLLUP_MEAN  1
+#define ROLLUP_MIN   2
+#define ROLLUP_MAX   3
+#define ROLLUP_LAST  4
+#define ROLLUP_STATS 5
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// one field over one window
+struct Rollup_Accumulator
+{
+	uint32_t count;
+	double sum;
+	double min;
+	double max;
+	double last;
+};
+
+struct Rollup_Field
+{
+	const Line_Key *keys[ROLLUP_STATS];
+	bool integer;
+	Rollup_Accumulator tiers[ROLLUP_TIERS];
+};
+
+// one message from one component
+struct Rollup_Message
+{
+	const Line_Key *measurements[ROLLUP_TIERS];
+	uint64_t window[ROLLUP_TIERS];      // start of the window being filled
+	uint64_t closed_start[ROLLUP_TIERS];
+	uint8_t closed;                     // tiers with a window to write
+	std::vector<Rollup_Field> fields;
+};
+
+// fields of the message being written, in the order they are written
+struct Rollup_Cursor
+{
+	Rollup_Message *message;  // NULL when rollups are off
+	size_t index;
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Rollup Class
+// ----------------------------------------------------------------------------------
+/*
+ * Rollup Class
+ *
+ * Aggregates every field over 1 s, 10 s and 60 s windows as the samples come
+ * in, so long range dashboards can read a few points per minute instead of
+ * the raw stream. For each window and field the count, mean, min, max and
+ * last sample are written as <field>_count, <field>_mean, <field>_min,
+ * <field>_max and <field>_last, in a point stamped with the start of the
+ * window.
+ *
+ * Each tier goes to its own measurement, <measurement>_1s and so on, or with
+ * retention policies set to the measurement itself in the policy of the
+ * tier, see tier_policy().
+ *
+ * Windows are aligned on the clock and closed by the first message past
+ * their end, before its samples are added. Windows of messages that stopped
+ * coming are closed by close() once they are ROLLUP_GRACE_NS past their end,
+ * and on shutdown all of them. A message stamped before its current window
+ * is added to it. The state is a fixed accumulator per field and tier, kept
+ * per (sysid, compid, message).
+ */
+class Rollup
+{
+
+public:
+
+	Rollup();
+
+	// set before the first message
+	bool enabled;
+	bool retention_policies;
+
+	// retention policy the tier is written to
+	static const char *tier_policy(int tier);
+
+	// starts a message, its fields then go through sample()
+	void begin(Rollup_Cursor &cursor, const Line_Key &measurement, int sysid, int compid, uint64_t now);
+
+	// a window of tier was closed by begin() and has to be written
+	bool closed(const Rollup_Cursor &cursor, int tier) const
+	{
+		return cursor.message && (cursor.message->closed & (1 << tier));
+	}
+	const Line_Key &measurement(const Rollup_Cursor &cursor, int tier) const
+	{
+		return *cursor.message->measurements[tier];
+	}
+
+	// writes the fields of the closed window and clears it, returns its start
+	uint64_t write(Line_Buffer &point, Rollup_Cursor &cursor, int tier);
+
+	void sample(Rollup_Cursor &cursor, const Line_Key &name, double value, bool integer);
+
+	// closes the windows that ended before now, at most once a second, or all
+	// of them with now 0; write_closed(cursor, sysid, compid) is called for
+	// each message with a window to write, as after begin()
+	template <typename Writer>
+	void close(uint64_t now, Writer write_closed)
+	{
+		if ( !enabled || (now && now < next_close) )
+		{
+			return;
+		}
+		next_close = now + 1000000000ULL;
+
+		for ( auto &entry : messages )
+		{
+			Rollup_Cursor cursor;
+			cursor.message = &entry.second;
+			cursor.index   = 0;
+
+			if ( _close(entry.second, now) )
+			{
+				write_closed(cursor, entry.first.sysid, entry.first.compid);
+			}
+		}
+	}
+
+private:
+
+	struct Message_Key
+	{
+		int sysid;
+		int compid;
+		const Line_Key *measurement;
+
+		bool operator<(const Message_Key &other) const
+		{
+			if ( sysid != other.sysid )
+				return sysid < other.sysid;
+			if ( compid != other.compid )
+				return compid < other.compid;
+			return measurement < other.measurement;
+		}
+	};
+
+	std::map<Message_Key, Rollup_Message> messages;
+
+	// suffixed measurement and field names, kept for the pointers to them
+	std::deque<Line_Key> keys;
+
+	uint64_t next_close;
+
+	bool _close(Rollup_Message &message, uint64_t now);
+
+	const Line_Key *_key(const Line_Key &base, const char *suffix, bool measurement);
+
+};
+
+
+
+#endif // ROLLUP_H_
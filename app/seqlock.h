@@ -0,0 +1,66 @@
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+// ----------------------------------------------------------------------------------
+//   Seqlock Class
+// ----------------------------------------------------------------------------------
+/*
+ * Seqlock Class
+ *
+ * Sequence counter guarding data with a single writer and any number of
+ * readers. The writer never waits: it bumps the counter to an odd value,
+ * updates the data in place and bumps it back to even. Readers copy the data
+ * and retry if the counter moved (or was odd) meanwhile, so they always get
+ * a consistent copy without ever blocking the writer.
+ */
+class Seqlock
+{
+public:
+
+	Seqlock() : sequence(0) {}
+
+	void write_begin()
+	{
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void write_end()
+	{
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// copies src into dst, consistent with respect to the writer
+	template <typename T>
+	void read(T &dst, const T &src) const
+	{
+		uint32_t start;
+		do
+		{
+			// writer in progress, try again
+			while ( (start = sequence.load(std::memory_order_acquire)) & 1 );
+
+			memcpy((void *)&dst, (const void *)&src, sizeof(T));
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+		}
+		while ( sequence.load(std::memory_order_relaxed) != start );
+	}
+
+private:
+
+	std::atomic<uint32_t> sequence;
+
+};
+
+
+
+#endif // SEQLOCK_H_
@@ -42,6 +42,9 @@ initialize_defaults()
 	fd     = -1;
 	is_open = false;
 
+	buff_ptr = 0;
+	buff_len = 0;
+
 	uart_name = (char*)"/dev/ttyUSB0";
 	baudrate  = 57600;
 
@@ -63,7 +66,6 @@ Serial_Port::
 read_message(mavlink_message_t &message)
 {
 	uint8_t          cp;
-	mavlink_status_t status;
 	uint8_t          msgReceived = false;
 
 	// --------------------------------------------------------------------------
@@ -79,17 +81,17 @@ read_message(mavlink_message_t &message)
 	// --------------------------------------------------------------------------
 	if (result > 0)
 	{
-		// the parsing
-		msgReceived = mavlink_parse_char(MAVLINK_COMM_1, cp, &message, &status);
+		// the parsing, on this port's own parser state
+		msgReceived = parser.parse_char(cp, message);
 
 		// check for dropped packets
-		if ( (lastStatus.packet_rx_drop_count != status.packet_rx_drop_count) && debug )
+		if ( (lastStatus.packet_rx_drop_count != parser.status.packet_rx_drop_count) && debug )
 		{
-			printf("ERROR: DROPPED %d PACKETS\n", status.packet_rx_drop_count);
+			printf("ERROR: DROPPED %d PACKETS\n", parser.status.packet_rx_drop_count);
 			unsigned char v=cp;
 			fprintf(stderr,"%02x ", v);
 		}
-		lastStatus = status;
+		lastStatus = parser.status;
 	}
 
 	// Couldn't read from port
@@ -135,6 +137,56 @@ read_message(mavlink_message_t &message)
 	return msgReceived;
 }
 
+// ------------------------------------------------------------------------------
+//   Read all Messages from Serial
+// ------------------------------------------------------------------------------
+// Decodes a whole read chunk in one pass, calling back for every message.
+// Returns the number of bytes consumed from the port.
+int
+Serial_Port::
+read_messages(const Message_Callback &callback)
+{
+	// --------------------------------------------------------------------------
+	//   READ FROM PORT
+	// --------------------------------------------------------------------------
+
+	// bytes left over by read_message() go first
+	if (buff_ptr >= buff_len)
+	{
+		// this function locks the port during read
+		int result = _fill_buffer();
+
+		// Nothing ready on a non-blocking port
+		if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			return 0;
+		}
+
+		// Couldn't read from port
+		if (result <= 0)
+		{
+			fprintf(stderr, "ERROR: Could not read from fd %d\n", fd);
+			return result;
+		}
+	}
+
+	// --------------------------------------------------------------------------
+	//   PARSE MESSAGES
+	// --------------------------------------------------------------------------
+	int bytes = buff_len - buff_ptr;
+	parser.parse(buff + buff_ptr, bytes, callback);
+	buff_ptr = buff_len;
+
+	// check for dropped packets
+	if ( (lastStatus.packet_rx_drop_count != parser.status.packet_rx_drop_count) && debug )
+	{
+		printf("ERROR: DROPPED %d PACKETS\n", parser.status.packet_rx_drop_count);
+	}
+	lastStatus = parser.status;
+
+	return bytes;
+}
+
 // ------------------------------------------------------------------------------
 //   Write to Serial
 // ------------------------------------------------------------------------------
@@ -204,6 +256,11 @@ start()
 	printf("Connected to %s with %d baud, 8 data bits, no parity, 1 stop bit (8N1)\n", uart_name, baudrate);
 	lastStatus.packet_rx_drop_count = 0;
 
+	// drop anything left over from a previous session
+	buff_ptr = 0;
+	buff_len = 0;
+	parser.reset();
+
 	is_open = true;
 
 	printf("\n");
@@ -235,6 +292,28 @@ stop()
 
 }
 
+// ------------------------------------------------------------------------------
+//   Blocking Mode
+// ------------------------------------------------------------------------------
+// In non-blocking mode read_messages() returns 0 instead of waiting when
+// the tty has nothing ready, for use with epoll.
+void
+Serial_Port::
+set_blocking(bool blocking)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	if (blocking)
+		flags &= ~O_NONBLOCK;
+	else
+		flags |= O_NONBLOCK;
+
+	if (fcntl(fd, F_SETFL, flags) < 0)
+	{
+		fprintf(stderr, "WARNING: could not change blocking mode of fd %d\n", fd);
+	}
+}
+
 // ------------------------------------------------------------------------------
 //   Helper Function - Open Serial Port File Descriptor
 // ------------------------------------------------------------------------------
@@ -422,19 +501,53 @@ _setup_port(int baud, int data_bits, int stop_bits, bool parity, bool hardware_c
 // ------------------------------------------------------------------------------
 //   Read Port with Lock
 // ------------------------------------------------------------------------------
+// Bytes are handed out from buff, the port is only touched (and locked) when
+// the buffer runs dry.
 int
 Serial_Port::
 _read_port(uint8_t &cp)
+{
+
+	if(buff_ptr >= buff_len)
+	{
+		int result = _fill_buffer();
+		if(result <= 0)
+		{
+			return result;
+		}
+	}
+
+	cp = buff[buff_ptr];
+	buff_ptr++;
+
+	return 1;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Fill Buffer with Lock
+// ------------------------------------------------------------------------------
+// One read() pulls everything the tty has ready, up to BUFF_LEN bytes,
+// instead of a single byte per syscall.
+int
+Serial_Port::
+_fill_buffer()
 {
 
 	// Lock
 	pthread_mutex_lock(&lock);
 
-	int result = read(fd, &cp, 1);
+	int result = read(fd, buff, BUFF_LEN);
 
 	// Unlock
 	pthread_mutex_unlock(&lock);
 
+	if(result > 0)
+	{
+		buff_len = result;
+		buff_ptr = 0;
+	}
+
 	return result;
 }
 
@@ -12,6 +12,7 @@
 #include <termios.h> // POSIX terminal control definitions
 #include <pthread.h> // This uses POSIX Threads
 #include <signal.h>
+#include <errno.h>
 
 #include <common/mavlink.h>
 
@@ -65,11 +66,16 @@ public:
 	virtual ~Serial_Port();
 
 	int read_message(mavlink_message_t &message);
+	int read_messages(const Message_Callback &callback);
 	int write_message(const mavlink_message_t &message);
 
 	bool is_running(){
 		return is_open;
 	}
+	int get_fd(){
+		return fd;
+	}
+	void set_blocking(bool blocking);
 	void start();
 	void stop();
 
@@ -78,9 +84,14 @@ private:
 	int  fd;
 	mavlink_status_t lastStatus;
 	pthread_mutex_t  lock;
+	Mavlink_Parser   parser;
 
 	void initialize_defaults();
 
+	const static int BUFF_LEN=2041;
+	uint8_t buff[BUFF_LEN];
+	int buff_ptr;
+	int buff_len;
 	bool debug;
 	const char *uart_name;
 	int  baudrate;
@@ -89,6 +100,7 @@ private:
 	int  _open_port(const char* port);
 	bool _setup_port(int baud, int data_bits, int stop_bits, bool parity, bool hardware_control);
 	int  _read_port(uint8_t &cp);
+	int  _fill_buffer();
 	int _write_port(char *buf, unsigned len);
 
 };
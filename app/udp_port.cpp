@@ -17,6 +17,7 @@ UDP_Port(const char *target_ip_, int udp_port_)
 {
 	initialize_defaults();
 	target_ip = target_ip_;
+	target_addr.s_addr = inet_addr(target_ip);
 	rx_port  = udp_port_;
 	is_open = false;
 }
@@ -40,11 +41,31 @@ initialize_defaults()
 {
 	// Initialize attributes
 	target_ip = "127.0.0.1";
+	target_addr.s_addr = inet_addr(target_ip);
 	rx_port  = 14550;
+	rcvbuf_size = 0; // keep the system default
+	reuse_port = false;
+	rx_packets = 0;
+	rx_bytes = 0;
+	rx_dropped = 0;
 	tx_port  = -1;
+	memset(&tx_addr, 0, sizeof(tx_addr));
 	is_open = false;
 	debug = false;
 	sock = -1;
+	buff_ptr = 0;
+	buff_len = 0;
+
+	// point every ring slot at its buffer and address once
+	memset(ring_msg, 0, sizeof(ring_msg));
+	for (int i = 0; i < RING_LEN; i++)
+	{
+		ring_iov[i].iov_base = ring[i];
+		ring_iov[i].iov_len  = BUFF_LEN;
+		ring_msg[i].msg_hdr.msg_iov    = &ring_iov[i];
+		ring_msg[i].msg_hdr.msg_iovlen = 1;
+		ring_msg[i].msg_hdr.msg_name   = &ring_addr[i];
+	}
 
 	// Start mutex
 	int result = pthread_mutex_init(&lock, NULL);
@@ -64,7 +85,6 @@ UDP_Port::
 read_message(mavlink_message_t &message)
 {
 	uint8_t          cp;
-	mavlink_status_t status;
 	uint8_t          msgReceived = false;
 
 	// --------------------------------------------------------------------------
@@ -80,17 +100,17 @@ read_message(mavlink_message_t &message)
 	// --------------------------------------------------------------------------
 	if (result > 0)
 	{
-		// the parsing
-		msgReceived = mavlink_parse_char(MAVLINK_COMM_1, cp, &message, &status);
+		// the parsing, on this port's own parser state
+		msgReceived = parser.parse_char(cp, message);
 
 		// check for dropped packets
-		if ( (lastStatus.packet_rx_drop_count != status.packet_rx_drop_count) && debug )
+		if ( (lastStatus.packet_rx_drop_count != parser.status.packet_rx_drop_count) && debug )
 		{
-			printf("ERROR: DROPPED %d PACKETS\n", status.packet_rx_drop_count);
+			printf("ERROR: DROPPED %d PACKETS\n", parser.status.packet_rx_drop_count);
 			unsigned char v=cp;
 			fprintf(stderr,"%02x ", v);
 		}
-		lastStatus = status;
+		lastStatus = parser.status;
 	}
 
 	// Couldn't read from port
@@ -136,6 +156,121 @@ read_message(mavlink_message_t &message)
 	return msgReceived;
 }
 
+// ------------------------------------------------------------------------------
+//   Read all Messages from UDP
+// ------------------------------------------------------------------------------
+// Decodes a whole datagram in one pass, calling back for every message.
+// Returns the number of bytes consumed from the port.
+int
+UDP_Port::
+read_messages(const Message_Callback &callback)
+{
+	int bytes = 0;
+
+	// --------------------------------------------------------------------------
+	//   LEFTOVERS
+	// --------------------------------------------------------------------------
+
+	// bytes left over by read_message() go first
+	if(buff_ptr < buff_len){
+		bytes = buff_len - buff_ptr;
+		parser.parse((const uint8_t *)buff + buff_ptr, bytes, callback);
+		buff_ptr = buff_len;
+		return bytes;
+	}
+
+	// --------------------------------------------------------------------------
+	//   READ AND PARSE
+	// --------------------------------------------------------------------------
+
+	bytes = read_datagrams([&](const uint8_t *data, size_t len) {
+		parser.parse(data, len, callback);
+	});
+
+	// check for dropped packets
+	if ( (lastStatus.packet_rx_drop_count != parser.status.packet_rx_drop_count) && debug )
+	{
+		printf("ERROR: DROPPED %d PACKETS\n", parser.status.packet_rx_drop_count);
+	}
+	lastStatus = parser.status;
+
+	return bytes;
+}
+
+// ------------------------------------------------------------------------------
+//   Read Datagrams from UDP
+// ------------------------------------------------------------------------------
+// Calls back with every datagram queued on the socket, undecoded, blocking
+// for the first one unless the port is non-blocking. Returns the number of
+// bytes read, 0 if nothing was ready, -1 on error.
+int
+UDP_Port::
+read_datagrams(const Datagram_Callback &callback)
+{
+	int bytes = 0;
+
+	// the kernel overwrites the address and control lengths
+	for (int i = 0; i < RING_LEN; i++)
+	{
+		ring_msg[i].msg_hdr.msg_namelen    = sizeof(struct sockaddr_in);
+		ring_msg[i].msg_hdr.msg_control    = ring_ctrl[i];
+		ring_msg[i].msg_hdr.msg_controllen = sizeof(ring_ctrl[i]);
+	}
+
+	// Blocks for the first datagram only, then takes whatever else is queued.
+	// The socket is safe to read without the lock, writes are not held up.
+	int result = recvmmsg(sock, ring_msg, RING_LEN, MSG_WAITFORONE, NULL);
+
+	// Nothing ready on a non-blocking port
+	if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+		return 0;
+	}
+
+	// Couldn't read from port
+	if (result <= 0)
+	{
+		fprintf(stderr, "ERROR: Could not read, res = %d, errno = %d : %m\n", result, errno);
+		return result;
+	}
+
+	for (int i = 0; i < result; i++)
+	{
+		// learn the reply port, only until the first valid datagram
+		if (tx_port < 0)
+		{
+			pthread_mutex_lock(&lock);
+			_check_sender(ring_addr[i]);
+			pthread_mutex_unlock(&lock);
+		}
+
+		if (ring_msg[i].msg_hdr.msg_flags & MSG_TRUNC)
+		{
+			fprintf(stderr, "WARNING: datagram larger than %d bytes truncated\n", BUFF_LEN);
+		}
+
+		callback((const uint8_t *)ring[i], ring_msg[i].msg_len);
+		bytes += ring_msg[i].msg_len;
+	}
+
+	// the socket's drop counter so far rides along with every datagram
+	struct msghdr *last = &ring_msg[result - 1].msg_hdr;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(last); cmsg != NULL; cmsg = CMSG_NXTHDR(last, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+		{
+			uint32_t dropped;
+			memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+			rx_dropped.store(dropped, std::memory_order_relaxed);
+		}
+	}
+
+	rx_packets.fetch_add(result, std::memory_order_relaxed);
+	rx_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+	return bytes;
+}
+
 // ------------------------------------------------------------------------------
 //   Write to UDP
 // ------------------------------------------------------------------------------
@@ -187,6 +322,39 @@ start()
 	addr.sin_addr.s_addr = inet_addr(target_ip);;
 	addr.sin_port = htons(rx_port);
 
+	/* Make room for bursts - the kernel doubles the value and caps it at net.core.rmem_max */
+	if (rcvbuf_size > 0)
+	{
+		if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf_size, sizeof(rcvbuf_size)) < 0)
+		{
+			perror("error setting SO_RCVBUF");
+		}
+
+		int actual = 0;
+		socklen_t optlen = sizeof(actual);
+		getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &actual, &optlen);
+		if (actual < rcvbuf_size)
+		{
+			printf("WARNING: receive buffer is %i bytes, asked for %i (raise net.core.rmem_max)\n", actual, rcvbuf_size);
+		}
+	}
+
+	/* Several sockets on one port, each sender sticks to one of them */
+	int on = 1;
+	if (reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+	{
+		perror("error setting SO_REUSEPORT");
+		close(sock);
+		sock = -1;
+		throw EXIT_FAILURE;
+	}
+
+	/* Report datagrams dropped on a full receive buffer */
+	if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0)
+	{
+		perror("error setting SO_RXQ_OVFL");
+	}
+
 	if (bind(sock, (struct sockaddr *) &addr, sizeof(struct sockaddr)))
 	{
 		perror("error bind failed");
@@ -208,6 +376,11 @@ start()
 	printf("Listening to %s:%i\n", target_ip, rx_port);
 	lastStatus.packet_rx_drop_count = 0;
 
+	// drop anything left over from a previous session
+	buff_ptr = 0;
+	buff_len = 0;
+	parser.reset();
+
 	is_open = true;
 
 	printf("\n");
@@ -240,6 +413,28 @@ stop()
 
 }
 
+// ------------------------------------------------------------------------------
+//   Blocking Mode
+// ------------------------------------------------------------------------------
+// In non-blocking mode read_messages() returns 0 instead of waiting when
+// no datagram is queued, for use with epoll.
+void
+UDP_Port::
+set_blocking(bool blocking)
+{
+	int flags = fcntl(sock, F_GETFL, 0);
+
+	if (blocking)
+		flags &= ~O_NONBLOCK;
+	else
+		flags |= O_NONBLOCK;
+
+	if (fcntl(sock, F_SETFL, flags) < 0)
+	{
+		fprintf(stderr, "error setting nonblocking: %s\n", strerror(errno));
+	}
+}
+
 // ------------------------------------------------------------------------------
 //   Read Port with Lock
 // ------------------------------------------------------------------------------
@@ -248,8 +443,6 @@ UDP_Port::
 _read_port(uint8_t &cp)
 {
 
-	socklen_t len;
-
 	// Lock
 	pthread_mutex_lock(&lock);
 
@@ -259,20 +452,8 @@ _read_port(uint8_t &cp)
 		buff_ptr++;
 		result=1;
 	}else{
-		struct sockaddr_in addr;
-		len = sizeof(struct sockaddr_in);
-		result = recvfrom(sock, &buff, BUFF_LEN, 0, (struct sockaddr *)&addr, &len);
-		if(tx_port < 0){
-			if(strcmp(inet_ntoa(addr.sin_addr), target_ip) == 0){
-				tx_port = ntohs(addr.sin_port);
-				printf("Got first packet, sending to %s:%i\n", target_ip, rx_port);
-			}else{
-				printf("ERROR: Got packet from %s:%i but listening on %s\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), target_ip);
-			}
-		}
+		result = _fill_buffer();
 		if(result > 0){
-			buff_len=result;
-			buff_ptr=0;
 			cp=buff[buff_ptr];
 			buff_ptr++;
 			//printf("recvfrom: %i %i\n", result, cp);
@@ -286,6 +467,57 @@ _read_port(uint8_t &cp)
 }
 
 
+// ------------------------------------------------------------------------------
+//   Fill Buffer
+// ------------------------------------------------------------------------------
+// Receives one datagram into buff, must be called with the port locked.
+int
+UDP_Port::
+_fill_buffer()
+{
+	socklen_t len;
+
+	struct sockaddr_in addr;
+	len = sizeof(struct sockaddr_in);
+	int result = recvfrom(sock, &buff, BUFF_LEN, 0, (struct sockaddr *)&addr, &len);
+	if(result > 0 && tx_port < 0){
+		_check_sender(addr);
+	}
+	if(result > 0){
+		buff_len=result;
+		buff_ptr=0;
+	}
+
+	return result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Check Sender
+// ------------------------------------------------------------------------------
+// Learns the address to answer to from the first datagram sent by target_ip.
+// The address is compared in binary, strings are only built for the error.
+// Must be called with the port locked.
+void
+UDP_Port::
+_check_sender(const struct sockaddr_in &addr)
+{
+	if(tx_port >= 0){
+		return;
+	}
+
+	// listening on any address, whoever talks first gets the replies, at
+	// its own address rather than the wildcard
+	if(addr.sin_addr.s_addr == target_addr.s_addr || target_addr.s_addr == INADDR_ANY){
+		tx_addr = addr;
+		tx_port = ntohs(addr.sin_port);
+		printf("Got first packet, sending to %s:%i\n", inet_ntoa(addr.sin_addr), tx_port);
+	}else{
+		printf("ERROR: Got packet from %s:%i but listening on %s\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), target_ip);
+	}
+}
+
+
 // ------------------------------------------------------------------------------
 //   Write Port with Lock
 // ------------------------------------------------------------------------------
@@ -300,12 +532,7 @@ _write_port(char *buf, unsigned len)
 	// Write packet via UDP link
 	int bytesWritten = 0;
 	if(tx_port > 0){
-		struct sockaddr_in addr;
-		memset(&addr, 0, sizeof(addr));
-		addr.sin_family = AF_INET;
-		addr.sin_addr.s_addr = inet_addr(target_ip);
-		addr.sin_port = htons(tx_port);
-		bytesWritten = sendto(sock, buf, len, 0, (struct sockaddr*)&addr, sizeof(struct sockaddr_in));
+		bytesWritten = sendto(sock, buf, len, 0, (struct sockaddr*)&tx_addr, sizeof(struct sockaddr_in));
 		//printf("sendto: %i\n", bytesWritten);
 	}else{
 		printf("ERROR: Sending before first packet received!\n");
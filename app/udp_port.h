@@ -11,6 +11,7 @@
 #include <string.h>
 #include <pthread.h> // This uses POSIX Threads
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <unistd.h>
@@ -21,6 +22,7 @@
 #include <time.h>
 #include <arpa/inet.h>
 #include <stdbool.h>
+#include <atomic>
 
 #include <common/mavlink.h>
 
@@ -34,6 +36,9 @@
 //   Prototypes
 // ------------------------------------------------------------------------------
 
+// called once for every datagram read, before any decoding
+typedef std::function<void(const uint8_t *data, size_t len)> Datagram_Callback;
+
 // ----------------------------------------------------------------------------------
 //   UDP Port Manager Class
 // ----------------------------------------------------------------------------------
@@ -56,33 +61,74 @@ public:
 	virtual ~UDP_Port();
 
 	int read_message(mavlink_message_t &message);
+	int read_messages(const Message_Callback &callback);
+	int read_datagrams(const Datagram_Callback &callback);
 	int write_message(const mavlink_message_t &message);
 
 	bool is_running(){
 		return is_open;
 	}
+	int get_fd(){
+		return sock;
+	}
+	const char *get_target_ip(){
+		return target_ip;
+	}
+	int get_rx_port(){
+		return rx_port;
+	}
+	void set_blocking(bool blocking);
 	void start();
 	void stop();
 
+	int rcvbuf_size;
+
+	// set before start() to share the port with other listeners, the kernel
+	// spreads the senders over them by address
+	bool reuse_port;
+
+	// datagrams and bytes read, datagrams the kernel dropped on a full
+	// receive buffer
+	std::atomic<uint64_t> rx_packets;
+	std::atomic<uint64_t> rx_bytes;
+	std::atomic<uint64_t> rx_dropped;
+
 private:
 
 	mavlink_status_t lastStatus;
 	pthread_mutex_t  lock;
+	Mavlink_Parser   parser;
 
 	void initialize_defaults();
 
+public:
 	const static int BUFF_LEN=2041;
+
+private:
 	char buff[BUFF_LEN];
 	int buff_ptr;
 	int buff_len;
+
+	// preallocated datagram ring for recvmmsg()
+	const static int RING_LEN=32;
+	char ring[RING_LEN][BUFF_LEN];
+	struct iovec ring_iov[RING_LEN];
+	struct sockaddr_in ring_addr[RING_LEN];
+	struct mmsghdr ring_msg[RING_LEN];
+	char ring_ctrl[RING_LEN][CMSG_SPACE(sizeof(uint32_t))];
+
 	bool debug;
 	const char *target_ip;
+	struct in_addr target_addr;
 	int rx_port;
 	int tx_port;
+	struct sockaddr_in tx_addr;  // the first sender, valid once tx_port is set
 	int sock;
 	bool is_open;
 
 	int  _read_port(uint8_t &cp);
+	int  _fill_buffer();
+	void _check_sender(const struct sockaddr_in &addr);
 	int _write_port(char *buf, unsigned len);
 
 };
@@ -0,0 +1,134 @@
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "vehicle_clock.h"
+
+
+// ----------------------------------------------------------------------------------
+//   Vehicle Clock Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Vehicle_Clock::
+Vehicle_Clock()
+{
+	samples      = 0;
+	last_vehicle = 0;
+
+	base_vehicle = 0;
+	base_offset  = 0;
+	drift        = 0;
+
+	window_start   = 0;
+	window_vehicle = 0;
+	window_offset  = INT64_MAX;
+
+	have_anchor    = false;
+	anchor_vehicle = 0;
+	anchor_offset  = 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Estimate
+// ------------------------------------------------------------------------------
+bool
+Vehicle_Clock::
+sample(uint64_t vehicle_usec, uint64_t host_usec)
+{
+	int64_t offset = (int64_t)host_usec - (int64_t)vehicle_usec;
+
+	// a reboot starts the vehicle clock over, messages of one component
+	// arriving slightly out of order don't
+	if ( samples == 0 || vehicle_usec + VEHICLE_CLOCK_RESTART_USEC < last_vehicle )
+	{
+		_restart(vehicle_usec, offset);
+		return false;
+	}
+
+	samples++;
+	if ( vehicle_usec > last_vehicle )
+	{
+		last_vehicle = vehicle_usec;
+	}
+
+	// less delayed than the estimate allows, it was too late
+	if ( offset < _predict(vehicle_usec) )
+	{
+		base_vehicle = vehicle_usec;
+		base_offset  = offset;
+	}
+
+	if ( offset < window_offset )
+	{
+		window_vehicle = vehicle_usec;
+		window_offset  = offset;
+	}
+
+	if ( vehicle_usec < window_start + VEHICLE_CLOCK_WINDOW_USEC )
+	{
+		return true;
+	}
+
+	// slope between the least delayed samples of two windows
+	if ( have_anchor && window_vehicle > anchor_vehicle )
+	{
+		double slope = (double)(window_offset - anchor_offset) / (double)(window_vehicle - anchor_vehicle);
+		if ( slope > VEHICLE_CLOCK_MAX_DRIFT )
+			slope = VEHICLE_CLOCK_MAX_DRIFT;
+		if ( slope < -VEHICLE_CLOCK_MAX_DRIFT )
+			slope = -VEHICLE_CLOCK_MAX_DRIFT;
+
+		drift += VEHICLE_CLOCK_DRIFT_GAIN * (slope - drift);
+	}
+
+	have_anchor    = true;
+	anchor_vehicle = window_vehicle;
+	anchor_offset  = window_offset;
+
+	// anchor on the window, unless that would move the estimate later
+	int64_t predicted = _predict(window_vehicle);
+	base_vehicle = window_vehicle;
+	base_offset  = window_offset < predicted ? window_offset : predicted;
+
+	window_start  = vehicle_usec;
+	window_offset = INT64_MAX;
+
+	return true;
+}
+
+uint64_t
+Vehicle_Clock::
+to_host(uint64_t vehicle_usec) const
+{
+	int64_t host = (int64_t)vehicle_usec + _predict(vehicle_usec);
+	return host > 0 ? (uint64_t)host : 0;
+}
+
+int64_t
+Vehicle_Clock::
+_predict(uint64_t vehicle_usec) const
+{
+	return base_offset + (int64_t)(drift * (double)((int64_t)vehicle_usec - (int64_t)base_vehicle));
+}
+
+void
+Vehicle_Clock::
+_restart(uint64_t vehicle_usec, int64_t offset)
+{
+	samples      = 1;
+	last_vehicle = vehicle_usec;
+
+	base_vehicle = vehicle_usec;
+	base_offset  = offset;
+	drift        = 0;
+
+	window_start   = vehicle_usec;
+	window_vehicle = vehicle_usec;
+	window_offset  = offset;
+
+	have_anchor = false;
+}
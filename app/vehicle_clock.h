@@ -0,0 +1,98 @@
+#ifndef VEHICLE_CLOCK_H_
+#define VEHICLE_CLOCK_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// the lowest offset is taken over this much vehicle time
+#define VEHICLE_CLOCK_WINDOW_USEC 5000000
+
+// crystals stay well within this, steeper slopes are delays changing
+#define VEHICLE_CLOCK_MAX_DRIFT 500e-6
+
+// weight of each new slope in the drift
+#define VEHICLE_CLOCK_DRIFT_GAIN 0.2
+
+// the vehicle clock going back more than this is a reboot
+#define VEHICLE_CLOCK_RESTART_USEC 2000000
+
+// time_usec fields past this (about 31 years) are Unix time, not time since boot
+#define VEHICLE_CLOCK_MAX_BOOT_USEC 1000000000000000ULL
+
+
+// ----------------------------------------------------------------------------------
+//   Vehicle Clock Class
+// ----------------------------------------------------------------------------------
+/*
+ * Vehicle Clock Class
+ *
+ * Maps the time since boot of one component, as carried by its time_usec and
+ * time_boot_ms fields, to the monotonic host clock. Every message with such a
+ * field is a sample of
+ *
+ *     offset = receive time - vehicle time = clock offset + link delay
+ *
+ * The delay is never negative, so the lowest offsets are the least delayed
+ * messages. The estimate follows that lower envelope: a sample below it moves
+ * the offset down right away, and once per window the least delayed sample
+ * anchors the offset again while the slope between consecutive windows
+ * smooths into the drift. Delays that grow for a while don't move the
+ * estimate later, only the drift does.
+ *
+ * A vehicle time going backwards starts the estimate over.
+ */
+class Vehicle_Clock
+{
+
+public:
+
+	Vehicle_Clock();
+
+	// false if the estimate started over, on the first sample or a reboot
+	bool sample(uint64_t vehicle_usec, uint64_t host_usec);
+
+	// host time of a vehicle time
+	uint64_t to_host(uint64_t vehicle_usec) const;
+
+	bool synced() const { return samples > 0; }
+
+	// host minus vehicle time at the anchor, and how fast that changes
+	int64_t offset_usec() const { return base_offset; }
+	double  drift_ppm()   const { return drift * 1e6; }
+
+private:
+
+	uint64_t samples;
+	uint64_t last_vehicle;
+
+	// host = vehicle + base_offset + drift * (vehicle - base_vehicle)
+	uint64_t base_vehicle;
+	int64_t  base_offset;
+	double   drift;
+
+	// least delayed sample of the current window
+	uint64_t window_start;
+	uint64_t window_vehicle;
+	int64_t  window_offset;
+
+	// that of the window before, the slope is taken from it
+	bool     have_anchor;
+	uint64_t anchor_vehicle;
+	int64_t  anchor_offset;
+
+	int64_t _predict(uint64_t vehicle_usec) const;
+	void _restart(uint64_t vehicle_usec, int64_t offset);
+
+};
+
+
+
+#endif // VEHICLE_CLOCK_H_
@@ -0,0 +1,131 @@
+#ifndef VEHICLE_TABLE_H_
+#define VEHICLE_TABLE_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+
+// ----------------------------------------------------------------------------------
+//   Vehicle Table Class
+// ----------------------------------------------------------------------------------
+/*
+ * Vehicle Table Class
+ *
+ * Flat open addressing hash map from (sysid, compid) to a T per component.
+ * The states live in one array allocated up front and are handed out in
+ * order of first appearance, so a pointer to a state stays valid for the
+ * life of the table. The slots are a power of two, at least twice the number
+ * of states, probed linearly from a multiplicative hash of the 16 bit key.
+ *
+ * One thread inserts, any number find() and at() concurrently: a slot is
+ * published with a release store once its state is ready, and entries are
+ * never removed. When all states are taken insert() returns NULL.
+ */
+template <typename T>
+class Vehicle_Table
+{
+public:
+
+	Vehicle_Table(size_t capacity_)
+	{
+		capacity = capacity_ > 0 ? capacity_ : 1;
+
+		size_t slot_count = 2;
+		bits = 1;
+		while ( slot_count < capacity * 2 )
+		{
+			slot_count <<= 1;
+			bits++;
+		}
+
+		states.reset(new T[capacity]);
+		slots.reset(new std::atomic<uint32_t>[slot_count]);
+		for ( size_t i = 0; i < slot_count; i++ )
+			slots[i].store(0, std::memory_order_relaxed);
+
+		mask  = slot_count - 1;
+		count = 0;
+	}
+
+	// any thread, NULL if the component was never seen
+	T *find(int sysid, int compid) const
+	{
+		uint32_t key = make_key(sysid, compid);
+
+		for ( size_t i = hash(key); ; i = (i + 1) & mask )
+		{
+			uint32_t slot = slots[i].load(std::memory_order_acquire);
+			if ( slot == 0 )
+				return NULL;
+			if ( (slot & 0xffff) == key )
+				return &states[(slot >> 16) - 1];
+		}
+	}
+
+	// inserting thread only, new states are set up by init before they are
+	// published; NULL if the table is full
+	template <typename Init>
+	T *insert(int sysid, int compid, Init init)
+	{
+		uint32_t key = make_key(sysid, compid);
+
+		size_t i = hash(key);
+		for ( ; ; i = (i + 1) & mask )
+		{
+			uint32_t slot = slots[i].load(std::memory_order_relaxed);
+			if ( slot == 0 )
+				break;
+			if ( (slot & 0xffff) == key )
+				return &states[(slot >> 16) - 1];
+		}
+
+		size_t index = count.load(std::memory_order_relaxed);
+		if ( index == capacity )
+			return NULL;
+
+		init(states[index]);
+
+		slots[i].store((uint32_t)(index + 1) << 16 | key, std::memory_order_release);
+		count.store(index + 1, std::memory_order_release);
+
+		return &states[index];
+	}
+
+	// states in order of first appearance
+	size_t size() const { return count.load(std::memory_order_acquire); }
+	T *at(size_t index) const { return &states[index]; }
+
+	size_t max_size() const { return capacity; }
+
+private:
+
+	std::unique_ptr<T[]> states;
+	std::unique_ptr<std::atomic<uint32_t>[]> slots;
+
+	size_t capacity;
+	size_t mask;
+	int bits;
+
+	std::atomic<size_t> count;
+
+	static uint32_t make_key(int sysid, int compid)
+	{
+		return (uint32_t)(sysid & 0xff) << 8 | (uint32_t)(compid & 0xff);
+	}
+
+	size_t hash(uint32_t key) const
+	{
+		// Fibonacci hashing, the top bits mix all of the key
+		return (size_t)((key * 2654435769u) >> (32 - bits)) & mask;
+	}
+
+};
+
+
+
+#endif // VEHICLE_TABLE_H_
@@ -27,9 +27,37 @@ top (int argc, char **argv)
 	char *udp_ip = (char*)"127.0.0.1";
 	int udp_port = 14540;
 	bool autotakeoff = false;
+	bool use_reactor = false;
+	int udp_rcvbuf = 0;
+	int batch_size = 5000;
+	int flush_interval_ms = 100;
+	bool message_schema = false;
+	char *influx_db = (char*)"telemetry";
+	int writer_threads = 1;
+	int writer_queue = 64;
+	int overflow_policy = INFLUX_OVERFLOW_DROP_OLDEST;
+	char *spool_dir = NULL;
+	int spool_budget = 1024;
+	int spool_rate = 1000;
+	int gzip_level = 0;
+	int gzip_min_bytes = 1024;
+	int influx_udp_port = 0;
+	int udp_mtu = 1500;
+	std::vector<char *> decimate_rules;
+	bool rollup = false;
+	bool rollup_rp = false;
+	int fleet_workers = 0;
+	int fleet_listeners = 0;
+	char *export_allow = NULL;
+	char *export_deny = NULL;
+	bool receive_time = false;
+	int timesync_ms = 1000;
 
 	// do the parse, will throw an int if it fails
-	parse_commandline(argc, argv, uart_name, baudrate, use_udp, udp_ip, udp_port, autotakeoff);
+	parse_commandline(argc, argv, uart_name, baudrate, use_udp, udp_ip, udp_port, autotakeoff, use_reactor, udp_rcvbuf,
+		batch_size, flush_interval_ms, message_schema, influx_db, writer_threads, writer_queue, overflow_policy,
+		spool_dir, spool_budget, spool_rate, gzip_level, gzip_min_bytes, influx_udp_port, udp_mtu, decimate_rules,
+		rollup, rollup_rp, fleet_workers, fleet_listeners, export_allow, export_deny, receive_time, timesync_ms);
 
 
 	// --------------------------------------------------------------------------
@@ -49,7 +77,10 @@ top (int argc, char **argv)
 	Generic_Port *port;
 	if(use_udp)
 	{
-		port = new UDP_Port(udp_ip, udp_port);
+		UDP_Port *udp = new UDP_Port(udp_ip, udp_port);
+		udp->rcvbuf_size = udp_rcvbuf;
+		udp->reuse_port = fleet_listeners > 0;
+		port = udp;
 	}
 	else
 	{
@@ -61,8 +92,8 @@ top (int argc, char **argv)
 	 * Instantiate an autopilot interface object
 	 *
 	 * This starts two threads for read and write over MAVlink. The read thread
-	 * listens for any MAVlink message and pushes it to the current_messages
-	 * attribute.  The write thread at the moment only streams a position target
+	 * listens for any MAVlink message and keeps the latest of each kind per
+	 * (sysid, compid).  The write thread at the moment only streams a position target
 	 * in the local NED frame (mavlink_set_position_target_local_ned_t), which
 	 * is changed by using the method update_setpoint().  Sending these messages
 	 * are only half the requirement to get response from the autopilot, a signal
@@ -73,26 +104,131 @@ top (int argc, char **argv)
 	 *
 	 */
 	Autopilot_Interface autopilot_interface(port);
+	autopilot_interface.use_reactor = use_reactor;
+	autopilot_interface.timesync_interval_ms = timesync_ms;
 
 	InfluxDB_Interface influx("localhost", 8086);
+	influx.batch_size = batch_size;
+	influx.flush_interval_ms = flush_interval_ms;
+	if (message_schema)
+	{
+		influx.schema = INFLUX_SCHEMA_MESSAGE;
+		influx.telemetry_db = influx_db;
+	}
+	influx.writer.threads = writer_threads;
+	influx.writer.max_queued = writer_queue;
+	influx.writer.overflow_policy = overflow_policy;
+	if (spool_dir)
+	{
+		influx.writer.spool.directory = spool_dir;
+		influx.writer.spool.disk_budget = (uint64_t)spool_budget * 1024 * 1024;
+		influx.writer.spool_rate = spool_rate;
+	}
+	influx.writer.gzip_level = gzip_level;
+	influx.writer.gzip_min_bytes = gzip_min_bytes;
+	if (influx_udp_port)
+	{
+		influx.output = INFLUX_OUTPUT_UDP;
+		influx.udp_port = influx_udp_port;
+		influx.udp.mtu = udp_mtu;
+	}
+	influx.vehicle_time = !receive_time;
+	influx.link_timing = timesync_ms > 0;
+	influx.rollup.enabled = rollup || rollup_rp;
+	influx.rollup.retention_policies = rollup_rp;
+	for (char *rule : decimate_rules)
+	{
+		if (!influx.decimator.add_rule(rule))
+		{
+			throw EXIT_FAILURE;
+		}
+	}
+	if (export_allow && !influx.exporter.allow(export_allow))
+	{
+		throw EXIT_FAILURE;
+	}
+	if (export_deny && !influx.exporter.deny(export_deny))
+	{
+		throw EXIT_FAILURE;
+	}
 
 	/*
 	 * Setup interrupt signal handler
 	 *
-	 * Responds to early exits signaled with Ctrl-C.  The handler will command
-	 * to exit offboard mode if required, and close threads and the port.
-	 * The handler in this example needs references to the above objects.
+	 * Responds to early exits signaled with Ctrl-C or by systemd.  The handler
+	 * only asks the loops below to leave, the shutdown after them flushes
+	 * what is batched and queued before the program ends.
 	 *
 	 */
-	port_quit         = port;
 	autopilot_interface_quit = &autopilot_interface;
+	time_to_quit = false;
 	signal(SIGINT,quit_handler);
+	signal(SIGTERM,quit_handler);
+
+	/*
+	 * Fleet aggregator mode
+	 *
+	 * Many vehicles on one UDP port. Nobody is talked to, the datagrams are
+	 * spread over worker threads by sysid, each decoding and batching for
+	 * its own vehicles into the shared writers. With listeners every worker
+	 * has its own socket on the port and the kernel does the spreading.
+	 */
+	if (fleet_workers > 0 || fleet_listeners > 0)
+	{
+		if (!use_udp)
+		{
+			printf("[ERROR] Fleet mode needs a UDP port (-u <udp_ip> -p <udp_port>).\n");
+			throw EXIT_FAILURE;
+		}
+
+		// nobody sends TIMESYNC requests here, replies on the port aren't
+		// ours to time the link with
+		influx.link_timing = false;
+
+		port->start();
+		influx.init();
+
+		Fleet_Aggregator fleet((UDP_Port *)port, influx);
+		if (fleet_workers > 0)
+			fleet.workers = fleet_workers;
+		fleet.listeners = fleet_listeners;
+
+		autopilot_interface_quit = NULL;
+		fleet.start();
+
+		printf("[INFO] Init done.\n");
+
+		int seconds = 0;
+		while (!time_to_quit)
+		{
+			sleep(1);
+			if (++seconds % 60 == 0)
+				fleet.print_stats();
+		}
+
+		printf("\n");
+		printf("TERMINATING AT USER REQUEST\n");
+		printf("\n");
+
+		// the workers flush what they hold into the writers before they're
+		// joined, then the writers send it
+		fleet.stop();
+		port->stop();
+		delete port;
+
+		influx.flushAll();
+		influx.writer.stop();
+
+		return 0;
+	}
 
 	/*
 	 * Start the port and autopilot_interface
 	 * This is where the port is opened, and read and write threads are started.
 	 */
 
+	influx.subscribe(autopilot_interface);
+
 	port->start();
 	autopilot_interface.start();
 	influx.init();
@@ -106,13 +242,25 @@ top (int argc, char **argv)
 
 	/*
 	 * Now we can implement the algorithm we want on top of the autopilot interface
+	 *
+	 * Every message decoded by the read thread is written once, in arrival
+	 * order. Sleeps while the queue is empty, batches are sent as they fill
+	 * up or get old.
 	 */
-	while (true)
+	Mavlink_Event event;
+	while (!time_to_quit)
 	{
-		influx.pushData(autopilot_interface.current_messages);
-		usleep(1000); // 1 kHz
+		if (autopilot_interface.wait_message(event, flush_interval_ms))
+		{
+			influx.pushMessage(event);
+		}
+		influx.flushDue();
 	}
 
+	printf("\n");
+	printf("TERMINATING AT USER REQUEST\n");
+	printf("\n");
+
 
 	// --------------------------------------------------------------------------
 	//   THREAD and PORT SHUTDOWN
@@ -126,6 +274,14 @@ top (int argc, char **argv)
 
 	delete port;
 
+	// what the read thread queued before it left, then the last batches
+	while (autopilot_interface.wait_message(event, 0))
+	{
+		influx.pushMessage(event);
+	}
+	influx.flushAll();
+	influx.writer.stop();
+
 	// --------------------------------------------------------------------------
 	//   DONE
 	// --------------------------------------------------------------------------
@@ -142,11 +298,17 @@ top (int argc, char **argv)
 // throws EXIT_FAILURE if could not open the port
 void
 parse_commandline(int argc, char **argv, char *&uart_name, int &baudrate,
-		bool &use_udp, char *&udp_ip, int &udp_port, bool &autotakeoff)
+		bool &use_udp, char *&udp_ip, int &udp_port, bool &autotakeoff, bool &use_reactor, int &udp_rcvbuf,
+		int &batch_size, int &flush_interval_ms, bool &message_schema, char *&influx_db,
+		int &writer_threads, int &writer_queue, int &overflow_policy,
+		char *&spool_dir, int &spool_budget, int &spool_rate, int &gzip_level, int &gzip_min_bytes,
+		int &influx_udp_port, int &udp_mtu, std::vector<char *> &decimate_rules,
+		bool &rollup, bool &rollup_rp, int &fleet_workers, int &fleet_listeners,
+		char *&export_allow, char *&export_deny, bool &receive_time, int &timesync_ms)
 {
 
 	// string for command line usage
-	const char *commandline_usage = "usage: mavlink_control [-d <devicename> -b <baudrate>] [-u <udp_ip> -p <udp_port>] [-a ]";
+	const char *commandline_usage = "usage: mavlink_control [-d <devicename> -b <baudrate>] [-u <udp_ip> -p <udp_port> --rcvbuf <bytes>] [-a ] [-r ] [--batch <points> --flush <ms>] [-m [--db <database>]] [--writers <threads> --queue <batches> --overflow drop-oldest|drop-newest|block] [--spool <dir> --spool-budget <MB> --spool-rate <points/s>] [--gzip <level> --gzip-min <bytes>] [--influx-udp <port> --mtu <bytes>] [--decimate <message[.field]=mode[:argument...]>...] [--rollup | --rollup-rp] [--export all|<message,...>] [--export-deny <message,...>] [--receive-time] [--timesync <ms>] [--fleet <workers> | --listeners <sockets>]";
 
 	// Read input arguments
 	for (int i = 1; i < argc; i++) { // argv[0] is "mavlink"
@@ -202,11 +364,260 @@ parse_commandline(int argc, char **argv, char *&uart_name, int &baudrate,
 			}
 		}
 
+		// UDP receive buffer size
+		if (strcmp(argv[i], "--rcvbuf") == 0) {
+			if (argc > i + 1) {
+				i++;
+				udp_rcvbuf = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// InfluxDB batch size
+		if (strcmp(argv[i], "--batch") == 0) {
+			if (argc > i + 1) {
+				i++;
+				batch_size = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// InfluxDB flush interval
+		if (strcmp(argv[i], "--flush") == 0) {
+			if (argc > i + 1) {
+				i++;
+				flush_interval_ms = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// One point per message
+		if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--message-schema") == 0) {
+			message_schema = true;
+		}
+
+		// Database for the message schema
+		if (strcmp(argv[i], "--db") == 0) {
+			if (argc > i + 1) {
+				i++;
+				influx_db = argv[i];
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// InfluxDB writer threads
+		if (strcmp(argv[i], "--writers") == 0) {
+			if (argc > i + 1) {
+				i++;
+				writer_threads = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Batches waiting for the writers
+		if (strcmp(argv[i], "--queue") == 0) {
+			if (argc > i + 1) {
+				i++;
+				writer_queue = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// What to do when the writers fall behind
+		if (strcmp(argv[i], "--overflow") == 0) {
+			if (argc > i + 1 && strcmp(argv[i + 1], "drop-oldest") == 0) {
+				overflow_policy = INFLUX_OVERFLOW_DROP_OLDEST;
+			} else if (argc > i + 1 && strcmp(argv[i + 1], "drop-newest") == 0) {
+				overflow_policy = INFLUX_OVERFLOW_DROP_NEWEST;
+			} else if (argc > i + 1 && strcmp(argv[i + 1], "block") == 0) {
+				overflow_policy = INFLUX_OVERFLOW_BLOCK;
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+			i++;
+		}
+
+		// Spool directory for outages
+		if (strcmp(argv[i], "--spool") == 0) {
+			if (argc > i + 1) {
+				i++;
+				spool_dir = argv[i];
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Spool disk budget
+		if (strcmp(argv[i], "--spool-budget") == 0) {
+			if (argc > i + 1) {
+				i++;
+				spool_budget = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Spool replay rate
+		if (strcmp(argv[i], "--spool-rate") == 0) {
+			if (argc > i + 1) {
+				i++;
+				spool_rate = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Gzip level of the write bodies
+		if (strcmp(argv[i], "--gzip") == 0) {
+			if (argc > i + 1) {
+				i++;
+				gzip_level = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Smallest body worth compressing
+		if (strcmp(argv[i], "--gzip-min") == 0) {
+			if (argc > i + 1) {
+				i++;
+				gzip_min_bytes = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Line protocol to a UDP listener instead of HTTP
+		if (strcmp(argv[i], "--influx-udp") == 0) {
+			if (argc > i + 1) {
+				i++;
+				influx_udp_port = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Largest datagram, headers included
+		if (strcmp(argv[i], "--mtu") == 0) {
+			if (argc > i + 1) {
+				i++;
+				udp_mtu = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Per message or per field rates, can be repeated
+		if (strcmp(argv[i], "--decimate") == 0) {
+			if (argc > i + 1) {
+				i++;
+				decimate_rules.push_back(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Any other message, exported from its MAVLink description
+		if (strcmp(argv[i], "--export") == 0) {
+			if (argc > i + 1) {
+				i++;
+				export_allow = argv[i];
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Every message but these, or none of these if --export lists some
+		if (strcmp(argv[i], "--export-deny") == 0) {
+			if (argc > i + 1) {
+				i++;
+				export_deny = argv[i];
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Points stamped when received rather than by the vehicle's clock
+		if (strcmp(argv[i], "--receive-time") == 0) {
+			receive_time = true;
+		}
+
+		// Link round trip and clock offset every ms, 0 for none
+		if (strcmp(argv[i], "--timesync") == 0) {
+			if (argc > i + 1) {
+				i++;
+				timesync_ms = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// 1 s, 10 s and 60 s aggregates, in their own measurements
+		if (strcmp(argv[i], "--rollup") == 0) {
+			rollup = true;
+		}
+
+		// Same, in their own retention policies
+		if (strcmp(argv[i], "--rollup-rp") == 0) {
+			rollup_rp = true;
+		}
+
+		// Many vehicles on the UDP port, spread over worker threads
+		if (strcmp(argv[i], "--fleet") == 0) {
+			if (argc > i + 1) {
+				i++;
+				fleet_workers = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// Many vehicles on the UDP port, one SO_REUSEPORT socket per thread
+		if (strcmp(argv[i], "--listeners") == 0) {
+			if (argc > i + 1) {
+				i++;
+				fleet_listeners = atoi(argv[i]);
+			} else {
+				printf("%s\n",commandline_usage);
+				throw EXIT_FAILURE;
+			}
+		}
+
 		// Autotakeoff
 		if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--autotakeoff") == 0) {
 			autotakeoff = true;
 		}
 
+		// Event driven reads
+		if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--reactor") == 0) {
+			use_reactor = true;
+		}
+
 	}
 	// end: for each input argument
 
@@ -218,29 +629,15 @@ parse_commandline(int argc, char **argv, char *&uart_name, int &baudrate,
 // ------------------------------------------------------------------------------
 //   Quit Signal Handler
 // ------------------------------------------------------------------------------
-// this function is called when you press Ctrl-C
+// this function is called on Ctrl-C and SIGTERM, top() does the shutdown
 void
 quit_handler( int sig )
 {
-	printf("\n");
-	printf("TERMINATING AT USER REQUEST\n");
-	printf("\n");
+	time_to_quit = true;
 
-	// autopilot interface
-	try {
+	// the autopilot interface may still be waiting for the vehicle
+	if (autopilot_interface_quit)
 		autopilot_interface_quit->handle_quit(sig);
-	}
-	catch (int error){}
-
-	// port
-	try {
-		port_quit->stop();
-	}
-	catch (int error){}
-
-	// end program here
-	exit(0);
-
 }
 
 
@@ -15,6 +15,8 @@
 #include <signal.h>
 #include <time.h>
 #include <sys/time.h>
+#include <vector>
+#include <atomic>
 
 using std::string;
 using namespace std;
@@ -22,12 +24,12 @@ using namespace std;
 #include <common/mavlink.h>
 
 #include <iostream>
-#include <InfluxDBFactory.h>
 
 #include "app/autopilot_interface.h"
 #include "app/serial_port.h"
 #include "app/udp_port.h"
 #include "app/influxdb_interface.h"
+#include "app/fleet_aggregator.h"
 
 // ------------------------------------------------------------------------------
 //   Prototypes
@@ -37,10 +39,16 @@ int main(int argc, char **argv);
 int top(int argc, char **argv);
 
 void parse_commandline(int argc, char **argv, char *&uart_name, int &baudrate,
-		bool &use_udp, char *&udp_ip, int &udp_port, bool &autotakeoff);
+		bool &use_udp, char *&udp_ip, int &udp_port, bool &autotakeoff, bool &use_reactor, int &udp_rcvbuf,
+		int &batch_size, int &flush_interval_ms, bool &message_schema, char *&influx_db,
+		int &writer_threads, int &writer_queue, int &overflow_policy,
+		char *&spool_dir, int &spool_budget, int &spool_rate, int &gzip_level, int &gzip_min_bytes,
+		int &influx_udp_port, int &udp_mtu, std::vector<char *> &decimate_rules,
+		bool &rollup, bool &rollup_rp, int &fleet_workers, int &fleet_listeners,
+		char *&export_allow, char *&export_deny, bool &receive_time, int &timesync_ms);
 
 // quit handler
+std::atomic<bool> time_to_quit;
 Autopilot_Interface *autopilot_interface_quit;
-Generic_Port *port_quit;
 void quit_handler( int sig );
 
@@ -0,0 +1,455 @@
+// ------------------------------------------------------------------------------
+//   Http_Client against a fake server on the loopback
+// ------------------------------------------------------------------------------
+/*
+ * The server accepts one connection after the other on an ephemeral port and
+ * answers every request the way its mode says. It counts the connections and
+ * requests it saw, which is how connection reuse is checked.
+ *
+ *     make test
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+#include "app/http_client.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// how the fake server answers
+#define SERVE_NO_CONTENT     0  // 204, keeps the connection
+#define SERVE_CONTENT_LENGTH 1  // 200 with a Content-Length body
+#define SERVE_CHUNKED        2  // 200 with a chunked body
+#define SERVE_UNTIL_CLOSE    3  // 200 with a body ended by closing the connection
+#define SERVE_ONCE           4  // answers the first request, closes on the second
+#define SERVE_HANG_UP        5  // closes on every request without an answer
+#define SERVE_SILENT         6  // reads requests, never answers
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if ( !(condition) ) \
+		{ \
+			printf("[FAIL] %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while ( 0 )
+
+
+// ------------------------------------------------------------------------------
+//   Helper Functions
+// ------------------------------------------------------------------------------
+
+static uint64_t
+now_ms()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int
+listen_loopback(int backlog, int &port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if ( fd < 0 )
+	{
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port        = 0;
+
+	socklen_t len = sizeof(addr);
+	if ( bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	     listen(fd, backlog) < 0 ||
+	     getsockname(fd, (struct sockaddr *)&addr, &len) < 0 )
+	{
+		perror("listen");
+		exit(EXIT_FAILURE);
+	}
+
+	port = ntohs(addr.sin_port);
+	return fd;
+}
+
+static bool
+send_all(int fd, const char *data)
+{
+	size_t len = strlen(data);
+	while ( len > 0 )
+	{
+		ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+		if ( n <= 0 )
+		{
+			return false;
+		}
+		data += n;
+		len  -= n;
+	}
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Fake Server
+// ------------------------------------------------------------------------------
+
+struct Fake_Server
+{
+	int fd;
+	int port;
+	int mode;
+	pthread_t tid;
+
+	std::atomic<bool> stop;
+	std::atomic<int>  connections;
+	std::atomic<int>  requests;
+};
+
+// reads one request with its body, false once the client is gone
+static bool
+read_request(Fake_Server &server, int fd)
+{
+	std::string head;
+	char c;
+
+	while ( head.size() < 4 || head.compare(head.size() - 4, 4, "\r\n\r\n") != 0 )
+	{
+		// short waits, a stopped server must not hang in here
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if ( poll(&pfd, 1, 50) == 0 )
+		{
+			if ( server.stop )
+				return false;
+			continue;
+		}
+		if ( recv(fd, &c, 1, 0) != 1 )
+		{
+			return false;
+		}
+		head += c;
+	}
+
+	const char *length = strstr(head.c_str(), "Content-Length: ");
+	size_t body = length ? strtoul(length + 16, NULL, 10) : 0;
+
+	while ( body > 0 )
+	{
+		char buf[4096];
+		ssize_t n = recv(fd, buf, std::min(body, sizeof(buf)), 0);
+		if ( n <= 0 )
+		{
+			return false;
+		}
+		body -= n;
+	}
+
+	server.requests++;
+	return true;
+}
+
+// serves one connection until either side closes it
+static void
+serve_connection(Fake_Server &server, int fd)
+{
+	int count = 0;
+
+	while ( read_request(server, fd) )
+	{
+		count++;
+
+		switch ( server.mode )
+		{
+			case SERVE_NO_CONTENT:
+				send_all(fd, "HTTP/1.1 204 No Content\r\n\r\n");
+				break;
+
+			case SERVE_CONTENT_LENGTH:
+				send_all(fd, "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world");
+				break;
+
+			case SERVE_CHUNKED:
+				send_all(fd, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+				             "5\r\nhello\r\n6;ext=1\r\n world\r\n0\r\nX-Trailer: 1\r\n\r\n");
+				break;
+
+			case SERVE_UNTIL_CLOSE:
+				send_all(fd, "HTTP/1.0 200 OK\r\n\r\nhello world");
+				return;
+
+			case SERVE_ONCE:
+				if ( count > 1 )
+					return;
+				send_all(fd, "HTTP/1.1 204 No Content\r\n\r\n");
+				break;
+
+			case SERVE_HANG_UP:
+				return;
+
+			case SERVE_SILENT:
+				break;
+		}
+	}
+}
+
+static void *
+start_fake_server_thread(void *args)
+{
+	Fake_Server &server = *(Fake_Server *)args;
+
+	while ( !server.stop )
+	{
+		struct pollfd pfd = { server.fd, POLLIN, 0 };
+		if ( poll(&pfd, 1, 50) <= 0 )
+		{
+			continue;
+		}
+
+		int fd = accept(server.fd, NULL, NULL);
+		if ( fd < 0 )
+		{
+			continue;
+		}
+
+		server.connections++;
+		serve_connection(server, fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+static void
+server_start(Fake_Server &server, int mode)
+{
+	server.fd          = listen_loopback(16, server.port);
+	server.mode        = mode;
+	server.stop        = false;
+	server.connections = 0;
+	server.requests    = 0;
+
+	if ( pthread_create(&server.tid, NULL, &start_fake_server_thread, &server) )
+	{
+		perror("pthread_create");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void
+server_stop(Fake_Server &server)
+{
+	server.stop = true;
+	pthread_join(server.tid, NULL);
+	close(server.fd);
+}
+
+static int
+post(Http_Client &http, const char *&error)
+{
+	error = NULL;
+	return http.post("/write?db=test", "Content-Type: text/plain\r\n", "m x=1\n", 6, error);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Tests
+// ------------------------------------------------------------------------------
+
+// consecutive requests share one connection
+static void
+test_keep_alive()
+{
+	Fake_Server server;
+	server_start(server, SERVE_NO_CONTENT);
+
+	Http_Client http;
+	http.set_server("127.0.0.1", server.port);
+
+	const char *error;
+	for ( int i = 0; i < 5; i++ )
+	{
+		CHECK(post(http, error) == 204);
+	}
+
+	http.close_all();
+	server_stop(server);
+
+	CHECK(server.requests == 5);
+	CHECK(server.connections == 1);
+}
+
+// the pooled connection is closed by the server when the request arrives,
+// the request goes out once more on a new one
+static void
+test_resend_on_closed_connection()
+{
+	Fake_Server server;
+	server_start(server, SERVE_ONCE);
+
+	Http_Client http;
+	http.set_server("127.0.0.1", server.port);
+
+	const char *error;
+	CHECK(post(http, error) == 204);
+	CHECK(post(http, error) == 204);
+
+	http.close_all();
+	server_stop(server);
+
+	CHECK(server.requests == 3);
+	CHECK(server.connections == 2);
+}
+
+// a new connection that is closed isn't tried again, the request may have
+// been taken
+static void
+test_no_resend_on_new_connection()
+{
+	Fake_Server server;
+	server_start(server, SERVE_HANG_UP);
+
+	Http_Client http;
+	http.set_server("127.0.0.1", server.port);
+
+	const char *error;
+	CHECK(post(http, error) == -1);
+	CHECK(error != NULL);
+
+	http.close_all();
+	server_stop(server);
+
+	CHECK(server.requests == 1);
+	CHECK(server.connections == 1);
+}
+
+// bodies are read to their end so the connection can be used again
+static void
+test_bodies()
+{
+	int modes[] = { SERVE_CONTENT_LENGTH, SERVE_CHUNKED, SERVE_UNTIL_CLOSE };
+
+	for ( int mode : modes )
+	{
+		Fake_Server server;
+		server_start(server, mode);
+
+		Http_Client http;
+		http.set_server("127.0.0.1", server.port);
+
+		const char *error;
+		CHECK(post(http, error) == 200);
+		CHECK(post(http, error) == 200);
+
+		http.close_all();
+		server_stop(server);
+
+		CHECK(server.requests == 2);
+		CHECK(server.connections == (mode == SERVE_UNTIL_CLOSE ? 2 : 1));
+	}
+}
+
+// the accept queue of the listener is full, SYNs go unanswered
+static void
+test_connect_timeout()
+{
+	int port;
+	int fd = listen_loopback(0, port);
+
+	// takes the only place in the queue, it is never accepted
+	int filler = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port        = htons(port);
+	CHECK(connect(filler, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+	Http_Client http;
+	http.connect_timeout_ms = 200;
+	http.set_server("127.0.0.1", port);
+
+	const char *error;
+	uint64_t start = now_ms();
+	CHECK(post(http, error) == -1);
+	uint64_t elapsed = now_ms() - start;
+
+	CHECK(error != NULL && strcmp(error, "timed out") == 0);
+	CHECK(elapsed >= 190 && elapsed < 1000);
+
+	close(filler);
+	close(fd);
+}
+
+// the server takes the request and never answers
+static void
+test_request_timeout()
+{
+	Fake_Server server;
+	server_start(server, SERVE_SILENT);
+
+	Http_Client http;
+	http.request_timeout_ms = 300;
+	http.set_server("127.0.0.1", server.port);
+
+	const char *error;
+	uint64_t start = now_ms();
+	CHECK(post(http, error) == -1);
+	uint64_t elapsed = now_ms() - start;
+
+	CHECK(error != NULL && strcmp(error, "timed out") == 0);
+	CHECK(elapsed >= 290 && elapsed < 1300);
+
+	http.close_all();
+	server_stop(server);
+
+	CHECK(server.requests == 1);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Main
+// ------------------------------------------------------------------------------
+int
+main(int argc, char **argv)
+{
+	test_keep_alive();
+	test_resend_on_closed_connection();
+	test_no_resend_on_new_connection();
+	test_bodies();
+	test_connect_timeout();
+	test_request_timeout();
+
+	if ( failures )
+	{
+		printf("[FAIL] %d checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("[OK] http client\n");
+	return 0;
+}
@@ -0,0 +1,362 @@
+#!/usr/bin/env python3
+"""
+Generates app/mavlink_line_encoders.h from the MAVLink XML dialects.
+
+One encoder per message writes its fields as one point of line protocol, the
+way the exporter does from the MAVLink field descriptors, but with the
+offsets, types and escaped names fixed at generation time:
+
+    measurement     the message name in lower case
+    scalars         one field each, integers and enums as integers
+    arrays          one field per element, <field>_0, <field>_1...
+    char arrays     one string field
+
+The only branch in an encoder is around extension fields, which MAVLink 1
+frames don't carry; NaN is left to the writer.
+
+    tools/mavlink_line_encoders.py common.xml development.xml -o app/mavlink_line_encoders.h
+
+Includes are followed, each file is read once. Only the standard library is
+used, pymavlink isn't needed.
+"""
+
+import argparse
+import os
+import sys
+import xml.etree.ElementTree as ET
+
+
+# bytes, C type and Fields call of each MAVLink type
+TYPES = {
+    'char':     (1, 'char',     'field_int'),
+    'int8_t':   (1, 'int8_t',   'field_int'),
+    'uint8_t':  (1, 'uint8_t',  'field_int'),
+    'int16_t':  (2, 'int16_t',  'field_int'),
+    'uint16_t': (2, 'uint16_t', 'field_int'),
+    'int32_t':  (4, 'int32_t',  'field_int'),
+    'uint32_t': (4, 'uint32_t', 'field_int'),
+    'int64_t':  (8, 'int64_t',  'field_int'),
+    'uint64_t': (8, 'uint64_t', 'field_int'),
+    'float':    (4, 'float',    'field'),
+    'double':   (8, 'double',   'field'),
+}
+
+
+class Field:
+
+    def __init__(self, element, extension):
+        self.name = element.get('name')
+        self.extension = extension
+
+        type_name = element.get('type')
+        self.array_length = 0
+        if '[' in type_name:
+            type_name, length = type_name.rstrip(']').split('[')
+            self.array_length = int(length)
+
+        # the heartbeat's mavlink_version is a plain uint8_t on the wire
+        if type_name == 'uint8_t_mavlink_version':
+            type_name = 'uint8_t'
+
+        if type_name not in TYPES:
+            raise ValueError('unknown type %s of field %s' % (element.get('type'), self.name))
+
+        self.type = type_name
+        self.size, self.ctype, self.call = TYPES[type_name]
+        self.offset = 0
+
+    @property
+    def count(self):
+        return self.array_length if self.array_length else 1
+
+    @property
+    def length(self):
+        return self.size * self.count
+
+    @property
+    def text(self):
+        return self.type == 'char' and self.array_length > 0
+
+
+class Message:
+
+    def __init__(self, element, source):
+        self.id = int(element.get('id'))
+        self.name = element.get('name')
+        self.source = source
+
+        fields = []
+        extension = False
+        for child in element:
+            if child.tag == 'extensions':
+                extension = True
+            elif child.tag == 'field':
+                fields.append(Field(child, extension))
+
+        # wire order: largest types first, the sort is stable; extensions
+        # follow in the order they were declared
+        base = sorted([f for f in fields if not f.extension], key=lambda f: -f.size)
+        self.fields = base + [f for f in fields if f.extension]
+
+        offset = 0
+        for field in self.fields:
+            field.offset = offset
+            offset += field.length
+
+        self.length = offset
+        self.min_length = sum(f.length for f in base)
+        self.crc_extra = crc_extra(self.name, base)
+
+    @property
+    def lower(self):
+        return self.name.lower()
+
+    # how the encoder reads the vehicle time, time_usec or time_boot_ms
+    @property
+    def vehicle_time(self):
+        for field in self.fields:
+            if field.name == 'time_usec' and field.type == 'uint64_t' and not field.array_length:
+                return 'line_load<uint64_t>(payload, %d)' % field.offset
+        for field in self.fields:
+            if field.name == 'time_boot_ms' and field.type == 'uint32_t' and not field.array_length:
+                return 'line_load<uint32_t>(payload, %d) * 1000ULL' % field.offset
+        return '0'
+
+    @property
+    def has_extensions(self):
+        return self.length != self.min_length
+
+
+def crc_accumulate(data, crc):
+    for byte in data:
+        tmp = byte ^ (crc & 0xff)
+        tmp = (tmp ^ (tmp << 4)) & 0xff
+        crc = ((crc >> 8) ^ (tmp << 8) ^ (tmp << 3) ^ (tmp >> 4)) & 0xffff
+    return crc
+
+
+# the seed MAVLink adds to the checksum, from the name and base fields
+def crc_extra(name, fields):
+    crc = crc_accumulate((name + ' ').encode(), 0xffff)
+    for field in fields:
+        crc = crc_accumulate((field.type + ' ' + field.name + ' ').encode(), crc)
+        if field.array_length:
+            crc = crc_accumulate(bytes([field.array_length]), crc)
+    return (crc & 0xff) ^ (crc >> 8)
+
+
+def read_dialect(path, messages, sources, seen):
+    path = os.path.realpath(path)
+    if path in seen:
+        return
+    seen.add(path)
+
+    root = ET.parse(path).getroot()
+
+    for include in root.findall('include'):
+        read_dialect(os.path.join(os.path.dirname(path), include.text.strip()), messages, sources, seen)
+
+    sources.append(os.path.basename(path))
+
+    for element in root.iter('message'):
+        message = Message(element, os.path.basename(path))
+        other = messages.get(message.id)
+        if other is not None:
+            if other.name != message.name:
+                raise ValueError('message %d is %s in %s and %s in %s'
+                                 % (message.id, other.name, other.source, message.name, message.source))
+            continue
+        messages[message.id] = message
+
+
+def key_name(name):
+    return 'LINE_KEY_' + name.upper()
+
+
+def check_name(name):
+    # keys are written as they are, names that would need escaping aren't
+    # valid MAVLink anyway
+    if not name.replace('_', '').isalnum():
+        raise ValueError('name %s needs escaping' % name)
+
+
+def generate(messages, sources, out):
+    w = out.write
+
+    w('// Generated by tools/mavlink_line_encoders.py from %s, do not edit.\n' % ', '.join(sources))
+    w('// make writes it again when the dialect changes.\n')
+    w('#ifndef MAVLINK_LINE_ENCODERS_H_\n')
+    w('#define MAVLINK_LINE_ENCODERS_H_\n')
+    w('\n')
+    w('// ------------------------------------------------------------------------------\n')
+    w('//   Includes\n')
+    w('// ------------------------------------------------------------------------------\n')
+    w('\n')
+    w('#include <stdint.h>\n')
+    w('#include <string.h>\n')
+    w('\n')
+    w('#include <common/mavlink.h>\n')
+    w('#include <development/mavlink.h>\n')
+    w('\n')
+    w('#include "line_protocol.h"\n')
+    w('\n')
+    w('\n')
+    w('// a field of a payload, which is packed and may not be aligned\n')
+    w('template <typename T>\n')
+    w('static inline T\n')
+    w('line_load(const uint8_t *payload, size_t offset)\n')
+    w('{\n')
+    w('\tT value;\n')
+    w('\tmemcpy(&value, payload + offset, sizeof(value));\n')
+    w('\treturn value;\n')
+    w('}\n')
+    w('\n')
+    w('\n')
+    w('// ------------------------------------------------------------------------------\n')
+    w('//   Keys\n')
+    w('// ------------------------------------------------------------------------------\n')
+    w('\n')
+
+    for message in messages:
+        check_name(message.lower)
+        w('static const Line_Key LINE_MEASUREMENT_%s("%s", true);\n' % (message.name, message.lower))
+    w('\n')
+
+    # field keys are shared by all messages with a field of that name
+    keys = set()
+    for message in messages:
+        for field in message.fields:
+            check_name(field.name)
+            if field.text or field.count == 1:
+                keys.add(field.name)
+            else:
+                keys.update('%s_%d' % (field.name, i) for i in range(field.count))
+
+    for key in sorted(keys):
+        w('static const Line_Key %s("%s");\n' % (key_name(key), key))
+    w('\n')
+    w('\n')
+
+    w('// ------------------------------------------------------------------------------\n')
+    w('//   Encoders\n')
+    w('// ------------------------------------------------------------------------------\n')
+    w('/*\n')
+    w(' * Each encoder writes a message through out, which provides\n')
+    w(' *\n')
+    w(' *     begin(measurement, vehicle time in microseconds or 0)\n')
+    w(' *     field(key, float or double)\n')
+    w(' *     field_int(key, int64_t)\n')
+    w(' *     field_string(key, chars, length)\n')
+    w(' *     end()\n')
+    w(' *\n')
+    w(' * The lengths and checksum seeds are checked against the MAVLink headers,\n')
+    w(' * these have to be generated from the same XML.\n')
+    w(' */\n')
+
+    for message in messages:
+        w('\n')
+        w('// %s (%d), %s\n' % (message.name, message.id, message.source))
+        w('static_assert(MAVLINK_MSG_ID_%s_LEN == %d && MAVLINK_MSG_ID_%s_MIN_LEN == %d && MAVLINK_MSG_ID_%s_CRC == %d,\n'
+          % (message.name, message.length, message.name, message.min_length, message.name, message.crc_extra))
+        w('              "%s differs from the MAVLink headers, regenerate");\n' % message.name)
+        w('\n')
+        w('template <typename Fields>\n')
+        w('static inline void\n')
+        w('encode_%s(Fields &out, const uint8_t *payload, bool%s)\n'
+          % (message.lower, ' extensions' if message.has_extensions else ''))
+        w('{\n')
+        w('\tout.begin(LINE_MEASUREMENT_%s, %s);\n' % (message.name, message.vehicle_time))
+
+        in_extensions = False
+        for field in message.fields:
+            if field.extension and not in_extensions:
+                in_extensions = True
+                w('\n')
+                w('\tif ( extensions )\n')
+                w('\t{\n')
+            indent = '\t\t' if in_extensions else '\t'
+
+            if field.text:
+                w('%sout.field_string(%s, (const char *)payload + %d, %d);\n'
+                  % (indent, key_name(field.name), field.offset, field.count))
+                continue
+
+            for i in range(field.count):
+                key = field.name if field.count == 1 else '%s_%d' % (field.name, i)
+                offset = field.offset + i * field.size
+                if field.type in ('char', 'int8_t'):
+                    value = '(int8_t)payload[%d]' % offset
+                elif field.type == 'uint8_t':
+                    value = 'payload[%d]' % offset
+                elif field.type == 'uint64_t':
+                    value = '(int64_t)line_load<uint64_t>(payload, %d)' % offset
+                else:
+                    value = 'line_load<%s>(payload, %d)' % (field.ctype, offset)
+                w('%sout.%s(%s, %s);\n' % (indent, field.call, key_name(key), value))
+
+        if in_extensions:
+            w('\t}\n')
+            w('\n')
+        w('\tout.end();\n')
+        w('}\n')
+
+    w('\n')
+    w('\n')
+    w('// ------------------------------------------------------------------------------\n')
+    w('//   Dispatch\n')
+    w('// ------------------------------------------------------------------------------\n')
+    w('\n')
+    w('// writes message as one point, false for a message not in the dialect\n')
+    w('template <typename Fields>\n')
+    w('static inline bool\n')
+    w('encode_mavlink_line(Fields &out, const mavlink_message_t &message)\n')
+    w('{\n')
+    w('\t// truncated MAVLink 2 payloads were zero filled by the parser\n')
+    w('\tconst uint8_t *payload = (const uint8_t *)_MAV_PAYLOAD(&message);\n')
+    w('\n')
+    w('\t// MAVLink 1 frames can\'t carry extension fields\n')
+    w('\tbool extensions = message.magic != MAVLINK_STX_MAVLINK1;\n')
+    w('\n')
+    w('\tswitch ( message.msgid )\n')
+    w('\t{\n')
+    for message in messages:
+        w('\t\tcase MAVLINK_MSG_ID_%s: encode_%s(out, payload, extensions); return true;\n'
+          % (message.name, message.lower))
+    w('\t}\n')
+    w('\n')
+    w('\treturn false;\n')
+    w('}\n')
+    w('\n')
+    w('\n')
+    w('\n')
+    w('#endif // MAVLINK_LINE_ENCODERS_H_\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generates line protocol encoders from MAVLink XML dialects.')
+    parser.add_argument('dialects', nargs='+', help='MAVLink XML files, includes are followed')
+    parser.add_argument('-o', '--output', required=True, help='header to write')
+    args = parser.parse_args()
+
+    messages = {}
+    sources = []
+    seen = set()
+    try:
+        for dialect in args.dialects:
+            read_dialect(dialect, messages, sources, seen)
+    except (ET.ParseError, OSError, ValueError) as e:
+        print('error: %s' % e, file=sys.stderr)
+        return 1
+
+    # written to a temporary first, make never sees half a header
+    temporary = args.output + '.tmp'
+    with open(temporary, 'w') as out:
+        generate([messages[msgid] for msgid in sorted(messages)], sources, out)
+    os.replace(temporary, args.output)
+
+    print('%s: %d messages' % (args.output, len(messages)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())